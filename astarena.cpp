@@ -0,0 +1,53 @@
+#include "astarena.h"
+#include <cstdlib>
+
+using namespace Cmp;
+using namespace std;
+
+AstArena::AstArena(size_t chunkSize)
+    : _cur(0)
+    , _used(0)
+    , _chunkSize(chunkSize)
+{ }
+
+AstArena::~AstArena()
+{
+    for (auto &c : _chunks)
+        free(c.first);
+}
+
+void *AstArena::allocate(size_t size, size_t align)
+{
+    for (;;) {
+        if (_cur < _chunks.size()) {
+            size_t start = (_used + align - 1) & ~(align - 1);
+            if (start + size <= _chunks[_cur].second) {
+                _used = start + size;
+                return _chunks[_cur].first + start;
+            }
+            // does not fit, move on to the next chunk
+            if (_cur + 1 < _chunks.size() || _used > 0) {
+                ++_cur;
+                _used = 0;
+                continue;
+            }
+        }
+
+        // need a new chunk, big ones get a chunk of their own
+        size_t sz = size + align > _chunkSize ? size + align : _chunkSize;
+        char *mem = static_cast<char*>(malloc(sz));
+        if (!mem)
+            throw bad_alloc();
+        _chunks.push_back(make_pair(mem, sz));
+        _cur = _chunks.size() - 1;
+        _used = 0;
+    }
+}
+
+size_t AstArena::bytesAllocated() const
+{
+    size_t sz = 0;
+    for (auto &c : _chunks)
+        sz += c.second;
+    return sz;
+}
@@ -0,0 +1,54 @@
+#ifndef ASTARENA_H
+#define ASTARENA_H
+
+#include <cstddef>
+#include <vector>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+namespace Cmp {
+
+// bump allocator for parse nodes, nodes are never destroyed one by one,
+// reset() drops everything at once and keeps the memory for the next parse.
+// Only trivially destructible types may live here.
+class AstArena
+{
+public:
+    // position to roll back to, everything allocated after it goes away
+    struct Mark {
+        size_t chunk, used;
+    };
+
+    explicit AstArena(size_t chunkSize = 64 * 1024);
+    ~AstArena();
+
+    void *allocate(size_t size, size_t align);
+
+    template<typename T, typename... Args>
+    T *create(Args&&... args)
+    {
+        static_assert(std::is_trivially_destructible<T>::value,
+                      "arena objects are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    Mark mark() const { Mark m = { _cur, _used }; return m; }
+    void rollback(const Mark &m) { _cur = m.chunk; _used = m.used; }
+    void reset() { _cur = 0; _used = 0; }
+
+    size_t bytesAllocated() const; // in all chunks
+
+private:
+    AstArena(const AstArena &) = delete;
+    AstArena &operator=(const AstArena &) = delete;
+
+    std::vector<std::pair<char*, size_t> > _chunks; // memory, size
+    size_t _cur,  // chunk we allocate from
+           _used, // bytes used in it
+           _chunkSize;
+};
+
+} // namespace Cmp
+
+#endif // ASTARENA_H
@@ -0,0 +1,192 @@
+// node throughput of the ParseNode pointer tree against the FlatAst
+// array, on a large synthetic program. Build with
+// -DCMAKE_BUILD_TYPE=Release, -O0 numbers say nothing
+//   ast_bench [terms] [rounds]
+#include "lexer.h"
+#include "parser.h"
+#include "sourcemanager.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <vector>
+#include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
+
+using namespace Cmp;
+using namespace std;
+
+namespace {
+
+const char *const _ops[] = { "+", "-", "*", "/", "%", "&", "|", "^", "<<", ">>",
+                             "<", "<=", "==", "!=", "&&", "||" };
+
+void expression(ostream &out, int depth)
+{
+    if (depth == 0 || rand() % 8 == 0) {
+        out << rand() % 100;
+        return;
+    }
+    if (rand() % 6 == 0) {
+        out << "-(";
+        expression(out, depth - 1);
+        out << ")";
+        return;
+    }
+    out << "(";
+    expression(out, depth - 1);
+    out << " " << _ops[rand() % 16] << " ";
+    expression(out, depth - 1);
+    out << ")";
+}
+
+double seconds(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// the same work on both: every node, its kind and its token type
+uint64_t walkTree(const ParseNode *root, size_t &nodes)
+{
+    uint64_t sum = 0;
+    vector<const ParseNode*> stack;
+    stack.push_back(root);
+    while (!stack.empty()) {
+        const ParseNode *n = stack.back();
+        stack.pop_back();
+        ++nodes;
+        sum += n->kind();
+        if (const LexToken *tok = n->lexToken())
+            sum += tok->type;
+        if (n->rightOperand()) stack.push_back(n->rightOperand());
+        if (n->operat()) stack.push_back(n->operat());
+        if (n->leftOperand()) stack.push_back(n->leftOperand());
+    }
+    return sum;
+}
+
+uint64_t walkFlat(const FlatAst &ast, size_t &nodes)
+{
+    uint64_t sum = 0;
+    vector<FlatAst::NodeIdx> stack;
+    stack.push_back(ast.root());
+    while (!stack.empty()) {
+        FlatAst::NodeIdx n = stack.back();
+        stack.pop_back();
+        ++nodes;
+        sum += ast.kind(n);
+        sum += ast.tokenType(n);
+        if (ast.right(n) != FlatAst::NoNode) stack.push_back(ast.right(n));
+        if (ast.operat(n) != FlatAst::NoNode) stack.push_back(ast.operat(n));
+        if (ast.left(n) != FlatAst::NoNode) stack.push_back(ast.left(n));
+    }
+    return sum;
+}
+
+// pre-order is the array order, no stack at all
+uint64_t scanFlat(const FlatAst &ast, size_t &nodes)
+{
+    uint64_t sum = 0;
+    for (FlatAst::NodeIdx n = 0; n < ast.size(); ++n)
+        sum += ast.kind(n) + ast.tokenType(n);
+    nodes += ast.size();
+    return sum;
+}
+
+// what the folder and ir builder do, the whole token with its value
+uint64_t scanFlatTokens(const FlatAst &ast, size_t &nodes)
+{
+    uint64_t sum = 0;
+    for (FlatAst::NodeIdx n = 0; n < ast.size(); ++n) {
+        LexToken tok = ast.token(n);
+        sum += ast.kind(n) + tok.type + tok.value;
+    }
+    nodes += ast.size();
+    return sum;
+}
+
+uint64_t walkTreeTokens(const ParseNode *root, size_t &nodes)
+{
+    uint64_t sum = 0;
+    vector<const ParseNode*> stack;
+    stack.push_back(root);
+    while (!stack.empty()) {
+        const ParseNode *n = stack.back();
+        stack.pop_back();
+        ++nodes;
+        sum += n->kind();
+        if (const LexToken *tok = n->lexToken())
+            sum += tok->type + tok->value;
+        if (n->rightOperand()) stack.push_back(n->rightOperand());
+        if (n->operat()) stack.push_back(n->operat());
+        if (n->leftOperand()) stack.push_back(n->leftOperand());
+    }
+    return sum;
+}
+
+template<typename Walk>
+void measure(const char *name, int rounds, Walk walk)
+{
+    size_t nodes = 0;
+    uint64_t sum = 0;
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r)
+        sum += walk(nodes);
+    double s = seconds(start);
+    printf("%-24s %8.1f M nodes/s  (%zu nodes, %.3f s, check %llu)\n", name,
+           static_cast<double>(nodes) / s / 1e6, nodes, s, static_cast<unsigned long long>(sum));
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    int terms = argc > 1 ? atoi(argv[1]) : 20000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 20;
+
+    srand(12345);
+    stringstream src;
+    // one function, the grammar has no more, of many random terms
+    src << "int main() {\n    return 0";
+    for (int t = 0; t < terms; ++t) {
+        src << "\n        + ";
+        expression(src, 8);
+    }
+    src << ";\n}\n";
+
+    char path[] = "/tmp/ast_benchXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+    ofstream(path) << src.str();
+
+    SourceManager sources;
+    const SourceBuffer *buf = sources.load(path);
+    unlink(path);
+    if (!buf) {
+        perror(path);
+        return 1;
+    }
+
+    Lexer lex(true);
+    Parser parser(&lex, path);
+    auto start = chrono::steady_clock::now();
+    parser.parseStream(buf->data(), path);
+    double parseTime = seconds(start);
+    if (!parser.isValid()) {
+        cerr << "synthetic program didn't parse\n";
+        return 1;
+    }
+    printf("%zu bytes, %zu nodes, parsed in %.3f s\n", buf->size(), parser.ast().size(), parseTime);
+
+    measure("pointer tree", rounds, [&](size_t &nodes) { return walkTree(parser.root(), nodes); });
+    measure("flat ast, stack walk", rounds, [&](size_t &nodes) { return walkFlat(parser.ast(), nodes); });
+    measure("flat ast, array scan", rounds, [&](size_t &nodes) { return scanFlat(parser.ast(), nodes); });
+    measure("pointer tree + values", rounds, [&](size_t &nodes) { return walkTreeTokens(parser.root(), nodes); });
+    measure("flat ast + values", rounds, [&](size_t &nodes) { return scanFlatTokens(parser.ast(), nodes); });
+    return 0;
+}
@@ -0,0 +1,106 @@
+// lexer throughput in MB/s and tokens/s, for each SimdScan level
+//   lexer_bench [file.c] [rounds]
+// without a file it lexes a synthetic program of about 8MB, build with
+// -DCMAKE_BUILD_TYPE=Release
+#include "lexer.h"
+#include "simdscan.h"
+#include "sourcemanager.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
+
+using namespace Cmp;
+using namespace std;
+
+namespace {
+
+const char *const _ops[] = { "+", "-", "*", "/", "%", "&", "|", "^", "<<", ">>",
+                             "<", "<=", "==", "!=", "&&", "||" };
+const char *const _names[] = { "a", "value", "count_2", "x", "tmp", "lengthOfSomething" };
+
+// looks like code: statements, comments, numbers in every base
+void function(ostream &out, int nr)
+{
+    out << "/* function " << nr << "\n * does nothing useful\n */\n"
+        << "int f" << nr << "() {\n";
+    int statements = 4 + rand() % 12;
+    for (int s = 0; s < statements; ++s) {
+        out << "    return ";
+        int terms = 1 + rand() % 6;
+        for (int t = 0; t < terms; ++t) {
+            if (t)
+                out << " " << _ops[rand() % 16] << " ";
+            switch (rand() % 6) {
+            case 0: out << "0x" << hex << rand() % 65536 << dec; break;
+            case 1: out << "0" << oct << rand() % 512 << dec; break;
+            case 2: out << "0b" << (rand() % 2) << (rand() % 2) << "1"; break;
+            case 3: out << "(" << _names[rand() % 6] << " + 1)"; break;
+            default: out << rand() % 100000; break;
+            }
+        }
+        out << ";";
+        if (rand() % 3 == 0)
+            out << " // " << "note " << s;
+        out << "\n";
+    }
+    out << "}\n\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    int rounds = argc > 2 ? atoi(argv[2]) : 10;
+    string path;
+    if (argc > 1) {
+        path = argv[1];
+    } else {
+        char tmpl[] = "/tmp/lexer_benchXXXXXX";
+        int fd = mkstemp(tmpl);
+        if (fd < 0) {
+            perror("mkstemp");
+            return 1;
+        }
+        close(fd);
+        path = tmpl;
+        srand(12345);
+        stringstream src;
+        for (int f = 0; src.tellp() < 8 * 1024 * 1024; ++f)
+            function(src, f);
+        ofstream(path) << src.str();
+    }
+
+    SourceManager sources;
+    const SourceBuffer *buf = sources.load(path.c_str());
+    if (argc < 2)
+        unlink(path.c_str());
+    if (!buf) {
+        perror(path.c_str());
+        return 1;
+    }
+
+    static const char *const levels[] = { "scalar", "sse2", "avx2" };
+    for (int l = SimdScan::Scalar; l <= SimdScan::detected(); ++l) {
+        SimdScan::setLevel(static_cast<SimdScan::Level>(l));
+        size_t tokens = 0;
+        auto start = chrono::steady_clock::now();
+        for (int r = 0; r < rounds; ++r) {
+            Lexer lex(true);
+            const char *src = buf->data();
+            if (!lex.tokenize(&src, path.c_str())) {
+                cerr << path << " did not lex\n";
+                return 1;
+            }
+            tokens += lex.file(lex.fileId(path.c_str()))->tokens.size();
+        }
+        double s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        printf("%-7s %8.1f MB/s %8.1f M tokens/s  (%zu bytes, %zu tokens, %d rounds)\n", levels[l],
+               static_cast<double>(buf->size()) * rounds / s / 1e6,
+               static_cast<double>(tokens) / s / 1e6, buf->size(), tokens / rounds, rounds);
+    }
+    return 0;
+}
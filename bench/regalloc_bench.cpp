@@ -0,0 +1,139 @@
+// run time of register allocated code against the same code with
+// every temporary on the stack (--no-regalloc), jit'ed on this host
+//   regalloc_bench [terms] [rounds]
+// build with -DCMAKE_BUILD_TYPE=Release, the compiler speed doesn't
+// matter here but the timing loop does
+#include "lexer.h"
+#include "parser.h"
+#include "irbuilder.h"
+#include "generator.h"
+#include "peephole.h"
+#include "x86encoder.h"
+#include "jit.h"
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <vector>
+#include <cstdlib>
+#include <cstdio>
+
+using namespace Cmp;
+using namespace std;
+
+namespace {
+
+// no / and %, nothing in here may trap
+const char *const _ops[] = { "+", "-", "*", "&", "|", "^", "<", "==", "!=" };
+
+// a right nested chain, each left side stays live while the right side
+// is computed, length of them at once
+void chain(ostream &out, int length)
+{
+    if (length == 0) {
+        out << rand() % 100;
+        return;
+    }
+    out << "((" << rand() % 1000 << " * " << rand() % 1000 << ") " << _ops[rand() % 9] << " ";
+    bool shifted = rand() % 4 == 0;
+    if (shifted)
+        out << "(";
+    chain(out, length - 1);
+    if (shifted)
+        out << " << " << rand() % 8 << ")";
+    out << ")";
+}
+
+struct Compiled {
+    vector<uint8_t> code;
+    size_t entry, instructions;
+};
+
+bool compile(const string &src, Target target, bool stackOnly, Compiled &res)
+{
+    Lexer lex(true);
+    Parser parser(&lex, "bench.c");
+    parser.parseStream(src.c_str(), "bench.c");
+    if (!parser.isValid())
+        return false;
+    IrProgram ir;
+    IrBuilder builder(&lex);
+    if (!builder.build(parser.ast(), ir) || !ir.verify(cerr))
+        return false;
+    Generator gen(cerr, target);
+    gen.setStackOnly(stackOnly);
+    if (!gen.generate(ir))
+        return false;
+    Peephole peep;
+    peep.run(gen.code());
+    res.instructions = gen.code().instructionCount();
+
+    X86Encoder encoder(cerr, X86Encoder::Mode64);
+    if (!encoder.encode(gen.code(), res.code))
+        return false;
+    res.entry = static_cast<size_t>(encoder.labelPos(gen.code().findLabel("main")));
+    return true;
+}
+
+void measure(const char *name, const Compiled &c, int rounds, int &result)
+{
+    Jit jit;
+    if (!jit.load(c.code)) {
+        perror("jit");
+        return;
+    }
+    int sig = 0;
+    jit.run(c.entry, result, sig); // warm up
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r) {
+        if (!jit.run(c.entry, result, sig)) {
+            cerr << name << ": crashed with signal " << sig << "\n";
+            return;
+        }
+    }
+    double s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("%-22s %8.1f us/run  %7zu instructions %8zu bytes  (returns %d)\n", name,
+           s / rounds * 1e6, c.instructions, c.code.size(), result);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    int terms = argc > 1 ? atoi(argv[1]) : 2000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 2000;
+    if (!Jit::supported()) {
+        cerr << "needs an x86-64 host\n";
+        return 1;
+    }
+
+    // not folded, it all runs, terms chains of 4 to 19 live temporaries
+    srand(12345);
+    stringstream src;
+    src << "int main() {\n    return 0";
+    for (int t = 0; t < terms; ++t) {
+        src << "\n        + ";
+        chain(src, 4 + t % 16);
+    }
+    src << ";\n}\n";
+
+    const Target targets[] = { TargetI386, TargetX86_64 };
+    const char *const names[] = { "i386", "x86-64" };
+    for (int t = 0; t < 2; ++t) {
+        Compiled allocated, stack;
+        if (!compile(src.str(), targets[t], false, allocated) ||
+            !compile(src.str(), targets[t], true, stack))
+        {
+            cerr << "synthetic program didn't compile\n";
+            return 1;
+        }
+        int a = 0, b = 0;
+        string name = names[t];
+        measure((name + " registers").c_str(), allocated, rounds, a);
+        measure((name + " stack only").c_str(), stack, rounds, b);
+        if (a != b) {
+            cerr << "results differ\n";
+            return 1;
+        }
+    }
+    return 0;
+}
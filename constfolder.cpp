@@ -0,0 +1,140 @@
+#include "constfolder.h"
+
+using namespace Cmp;
+using namespace std;
+
+ConstantFolder::ConstantFolder()
+{ }
+
+size_t ConstantFolder::run(FlatAst &ast)
+{
+    size_t folded = 0;
+    // the nodes are in pre-order, walking them backwards does every
+    // child before its parent, so folds bubble up in one pass
+    for (FlatAst::NodeIdx n = static_cast<FlatAst::NodeIdx>(ast.size()); n-- > 0;) {
+        switch (ast.kind(n)) {
+        case ParseNode::UnaryOp:
+            folded += unaryOp(ast, n);
+            break;
+        case ParseNode::BinaryOp:
+            folded += binaryOp(ast, n);
+            break;
+        default: ;
+        }
+    }
+    return folded;
+}
+
+bool ConstantFolder::unaryOp(FlatAst &ast, FlatAst::NodeIdx n)
+{
+    uint32_t a;
+    if (!constant(ast, ast.left(n), a))
+        return false;
+
+    switch (ast.token(n).type) {
+    case LexToken::Plus: break;
+    case LexToken::Minus: a = 0u - a; break;
+    case LexToken::Tilde: a = ~a; break;
+    case LexToken::Exclamation: a = a == 0; break;
+    default:
+        return false;
+    }
+    return ast.setConstant(n, a);
+}
+
+bool ConstantFolder::binaryOp(FlatAst &ast, FlatAst::NodeIdx n)
+{
+    auto op = ast.token(n).type;
+    auto l = ast.left(n), r = ast.right(n);
+    uint32_t a = 0, b = 0, res;
+    bool lc = constant(ast, l, a),
+         rc = constant(ast, r, b);
+
+    if (op == LexToken::AndAnd || op == LexToken::OrOr) {
+        // a decided left side never runs the right one
+        if (lc && (op == LexToken::AndAnd) == (a == 0))
+            return ast.setConstant(n, op == LexToken::OrOr);
+        if (lc && rc)
+            return ast.setConstant(n, b != 0);
+        return false;
+    }
+
+    if (lc && rc) {
+        if (!evaluate(op, a, b, res))
+            return false;
+        return ast.setConstant(n, res);
+    }
+
+    switch (op) {
+    case LexToken::Plus:
+        if (rc && b == 0) { ast.replace(n, l); return true; }
+        if (lc && a == 0) { ast.replace(n, r); return true; }
+        break;
+    case LexToken::Minus:
+        if (rc && b == 0) { ast.replace(n, l); return true; }
+        break;
+    case LexToken::Star:
+        if ((rc && b == 0) || (lc && a == 0))
+            return ast.setConstant(n, 0);
+        if (rc && b == 1) { ast.replace(n, l); return true; }
+        if (lc && a == 1) { ast.replace(n, r); return true; }
+        break;
+    case LexToken::Slash:
+        if (rc && b == 1) { ast.replace(n, l); return true; }
+        break;
+    default: ;
+    }
+    return false;
+}
+
+// an int literal, or what we folded before
+bool ConstantFolder::constant(const FlatAst &ast, FlatAst::NodeIdx n, uint32_t &value)
+{
+    if (n == FlatAst::NoNode || ast.kind(n) != ParseNode::Constant)
+        return false;
+    LexToken tok = ast.token(n);
+    if (!tok.isInteger())
+        return false;
+    value = tok.intValue();
+    return true;
+}
+
+// unsigned math wraps like the machine does, signed only where it can't overflow
+bool ConstantFolder::evaluate(LexToken::Tokens op, uint32_t a, uint32_t b, uint32_t &res)
+{
+    int32_t sa = static_cast<int32_t>(a),
+            sb = static_cast<int32_t>(b);
+    switch (op) {
+    case LexToken::Plus: res = a + b; break;
+    case LexToken::Minus: res = a - b; break;
+    case LexToken::Star: res = a * b; break;
+    case LexToken::Slash:
+    case LexToken::Percent:
+        // idiv traps on these, leave that to run time
+        if (sb == 0 || (sa == INT32_MIN && sb == -1))
+            return false;
+        res = static_cast<uint32_t>(op == LexToken::Slash ? sa / sb : sa % sb);
+        break;
+    case LexToken::Ampersand: res = a & b; break;
+    case LexToken::Pipe: res = a | b; break;
+    case LexToken::Caret: res = a ^ b; break;
+    case LexToken::ShiftLeft:
+    case LexToken::ShiftRight:
+        if (b > 31)
+            return false; // undefined in C, the cpu masks the count
+        if (op == LexToken::ShiftLeft)
+            res = a << b;
+        else // arithmetic, like sarl
+            res = sa < 0 ? ~(~a >> b) : a >> b;
+        break;
+    case LexToken::EqualEqual: res = a == b; break;
+    case LexToken::NotEqual: res = a != b; break;
+    case LexToken::Less: res = sa < sb; break;
+    case LexToken::LessEqual: res = sa <= sb; break;
+    case LexToken::Greater: res = sa > sb; break;
+    case LexToken::GreaterEqual: res = sa >= sb; break;
+    default:
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,35 @@
+#ifndef CONSTFOLDER_H
+#define CONSTFOLDER_H
+
+#include <inttypes.h>
+#include <cstddef>
+#include "parser.h"
+
+namespace Cmp {
+
+// evaluates constant int expressions in the FlatAst before the generator
+// sees them, with 32bit wrap around like the hardware and C division
+// (truncates toward zero). Whatever traps or is out of range at run time
+// (x/0, INT_MIN/-1, shifts outside 0..31) is left alone.
+// Also simplifies x+0, 0+x, x-0, x*1, 1*x, x/1 to x and x*0, 0*x to 0,
+// there is nothing with side effects in an expression yet.
+// Rewritten nodes are marked FlatAst::Folded.
+class ConstantFolder
+{
+public:
+    explicit ConstantFolder();
+
+    // returns number of rewritten nodes
+    size_t run(FlatAst &ast);
+
+private:
+    bool unaryOp(FlatAst &ast, FlatAst::NodeIdx n);
+    bool binaryOp(FlatAst &ast, FlatAst::NodeIdx n);
+
+    static bool constant(const FlatAst &ast, FlatAst::NodeIdx n, uint32_t &value);
+    static bool evaluate(LexToken::Tokens op, uint32_t a, uint32_t b, uint32_t &res);
+};
+
+} // namespace Cmp
+
+#endif // CONSTFOLDER_H
@@ -0,0 +1,81 @@
+#include "elfwriter.h"
+#include <elf.h>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+
+using namespace Cmp;
+using namespace std;
+
+const uint32_t ElfWriter::LoadAddress;
+const uint32_t ElfWriter::LoadAddress64;
+
+namespace {
+
+// the headers only differ in their field sizes, Ehdr/Phdr are the
+// Elf32_ or Elf64_ ones
+template<typename Ehdr, typename Phdr>
+bool writeElf(const char *filename, const vector<uint8_t> &code, size_t entry,
+              unsigned char elfClass, uint16_t machine, uint32_t loadAddress)
+{
+    // code right after the headers, 16 aligned
+    const uint32_t codeOff = (sizeof(Ehdr) + sizeof(Phdr) + 15) & ~15u;
+
+    Ehdr eh;
+    memset(&eh, 0, sizeof(eh));
+    memcpy(eh.e_ident, ELFMAG, SELFMAG);
+    eh.e_ident[EI_CLASS] = elfClass;
+    eh.e_ident[EI_DATA] = ELFDATA2LSB;
+    eh.e_ident[EI_VERSION] = EV_CURRENT;
+    eh.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    eh.e_type = ET_EXEC;
+    eh.e_machine = machine;
+    eh.e_version = EV_CURRENT;
+    eh.e_entry = static_cast<decltype(eh.e_entry)>(loadAddress + codeOff + entry);
+    eh.e_phoff = sizeof(Ehdr);
+    eh.e_ehsize = sizeof(Ehdr);
+    eh.e_phentsize = sizeof(Phdr);
+    eh.e_phnum = 1;
+
+    Phdr ph;
+    memset(&ph, 0, sizeof(ph));
+    ph.p_type = PT_LOAD;
+    ph.p_offset = 0;
+    ph.p_vaddr = ph.p_paddr = loadAddress;
+    ph.p_filesz = ph.p_memsz = static_cast<decltype(ph.p_filesz)>(codeOff + code.size());
+    ph.p_flags = PF_R | PF_X;
+    ph.p_align = 0x1000;
+
+    char pad[16] = { 0 };
+    iovec iov[4] = {
+        { &eh, sizeof(eh) },
+        { &ph, sizeof(ph) },
+        { pad, codeOff - sizeof(eh) - sizeof(ph) },
+        { const_cast<uint8_t*>(code.data()), code.size() }
+    };
+    size_t total = codeOff + code.size();
+
+    // a new file like ld does, so it gets the exec bits from the umask
+    unlink(filename);
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0777);
+    if (fd < 0)
+        return false;
+    // a regular file, writev writes it all or fails
+    ssize_t n = writev(fd, iov, 4);
+    bool ok = n == static_cast<ssize_t>(total);
+    return close(fd) == 0 && ok;
+}
+
+} // namespace
+
+ElfWriter::ElfWriter(Machine machine)
+    : _machine(machine)
+{ }
+
+bool ElfWriter::write(const char *filename, const vector<uint8_t> &code, size_t entry) const
+{
+    if (_machine == X86_64)
+        return writeElf<Elf64_Ehdr, Elf64_Phdr>(filename, code, entry, ELFCLASS64, EM_X86_64, LoadAddress64);
+    return writeElf<Elf32_Ehdr, Elf32_Phdr>(filename, code, entry, ELFCLASS32, EM_386, LoadAddress);
+}
@@ -0,0 +1,31 @@
+#ifndef ELFWRITER_H
+#define ELFWRITER_H
+
+#include <inttypes.h>
+#include <cstddef>
+#include <vector>
+
+namespace Cmp {
+
+// writes a static i386 or x86-64 ELF executable, one PT_LOAD segment
+// that holds the headers and the code, no sections and no symbols
+class ElfWriter
+{
+public:
+    enum Machine { I386, X86_64 };
+
+    static const uint32_t LoadAddress = 0x08048000;
+    static const uint32_t LoadAddress64 = 0x400000;
+
+    explicit ElfWriter(Machine machine = I386);
+
+    // entry is an offset into code, false and errno set on failure
+    bool write(const char *filename, const std::vector<uint8_t> &code, size_t entry) const;
+
+private:
+    Machine _machine;
+};
+
+} // namespace Cmp
+
+#endif // ELFWRITER_H
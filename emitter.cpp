@@ -0,0 +1,141 @@
+#include "emitter.h"
+#include <cstdlib>
+#include <cerrno>
+#include <new>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+
+using namespace Cmp;
+using namespace std;
+
+Emitter::Emitter(size_t chunkSize)
+    : _cur(0)
+    , _chunkSize(chunkSize)
+    , _pos(nullptr)
+    , _end(nullptr)
+{ }
+
+Emitter::~Emitter()
+{
+    for (auto c : _chunks)
+        free(c);
+}
+
+void Emitter::clear()
+{
+    _cur = 0;
+    _pos = _chunks.empty() ? nullptr : _chunks[0];
+    _end = _chunks.empty() ? nullptr : _chunks[0] + _chunkSize;
+}
+
+void Emitter::nextChunk()
+{
+    if (_pos != nullptr)
+        ++_cur;
+    if (_cur == _chunks.size()) {
+        char *mem = static_cast<char*>(malloc(_chunkSize));
+        if (!mem)
+            throw bad_alloc();
+        _chunks.push_back(mem);
+    }
+    _pos = _chunks[_cur];
+    _end = _pos + _chunkSize;
+}
+
+size_t Emitter::used(size_t chunk) const
+{
+    return chunk < _cur ? _chunkSize : static_cast<size_t>(_pos - _chunks[_cur]);
+}
+
+size_t Emitter::size() const
+{
+    return _pos == nullptr ? 0 : _cur * _chunkSize + used(_cur);
+}
+
+void Emitter::write(const char *str, size_t len)
+{
+    while (len > 0) {
+        if (_pos == _end)
+            nextChunk();
+        size_t n = static_cast<size_t>(_end - _pos);
+        if (n > len)
+            n = len;
+        memcpy(_pos, str, n);
+        _pos += n;
+        str += n;
+        len -= n;
+    }
+}
+
+void Emitter::putUInt(uint64_t value)
+{
+    char buf[20], *p = buf + sizeof(buf);
+    do {
+        *--p = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value);
+    write(p, static_cast<size_t>(buf + sizeof(buf) - p));
+}
+
+void Emitter::putInt(int64_t value)
+{
+    if (value < 0) {
+        put('-');
+        // INT64_MIN can't be negated as signed
+        putUInt(~static_cast<uint64_t>(value) + 1);
+    } else
+        putUInt(static_cast<uint64_t>(value));
+}
+
+bool Emitter::flush(int fd) const
+{
+    if (_pos == nullptr)
+        return true;
+
+    // as many chunks as the kernel takes in one writev, partial writes
+    // continue where they stopped
+    size_t chunk = 0, skip = 0;
+    while (chunk <= _cur) {
+        iovec iov[64];
+        int cnt = 0;
+        for (size_t c = chunk; c <= _cur && cnt < 64; ++c, ++cnt) {
+            size_t off = c == chunk ? skip : 0;
+            iov[cnt].iov_base = _chunks[c] + off;
+            iov[cnt].iov_len = used(c) - off;
+        }
+        ssize_t n = writev(fd, iov, cnt);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        size_t left = static_cast<size_t>(n);
+        while (chunk <= _cur && left >= used(chunk) - skip) {
+            left -= used(chunk) - skip;
+            skip = 0;
+            ++chunk;
+        }
+        skip += left;
+    }
+    return true;
+}
+
+bool Emitter::writeFile(const char *filename) const
+{
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    bool ok = flush(fd);
+    return close(fd) == 0 && ok;
+}
+
+string Emitter::str() const
+{
+    string s;
+    s.reserve(size());
+    for (size_t c = 0; _pos != nullptr && c <= _cur; ++c)
+        s.append(_chunks[c], used(c));
+    return s;
+}
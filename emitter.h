@@ -0,0 +1,62 @@
+#ifndef EMITTER_H
+#define EMITTER_H
+
+#include <inttypes.h>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace Cmp {
+
+// output buffer for generated code, bytes go into a list of fixed size
+// chunks, nothing is moved when it grows. Integers are formatted by hand
+// and flush() hands all chunks to the kernel with writev.
+class Emitter
+{
+public:
+    explicit Emitter(size_t chunkSize = 64 * 1024);
+    ~Emitter();
+
+    void clear();   // keeps the chunks for reuse
+    size_t size() const;
+    bool empty() const { return size() == 0; }
+
+    void write(const char *str, size_t len);
+    void put(char c) { if (_pos == _end) nextChunk(); *_pos++ = c; }
+    void putInt(int64_t value);
+    void putUInt(uint64_t value);
+
+    Emitter &operator<<(const char *str) { write(str, strlen(str)); return *this; }
+    Emitter &operator<<(const std::string &str) { write(str.data(), str.size()); return *this; }
+    Emitter &operator<<(char c) { put(c); return *this; }
+    Emitter &operator<<(int v) { putInt(v); return *this; }
+    Emitter &operator<<(long v) { putInt(v); return *this; }
+    Emitter &operator<<(long long v) { putInt(v); return *this; }
+    Emitter &operator<<(unsigned v) { putUInt(v); return *this; }
+    Emitter &operator<<(unsigned long v) { putUInt(v); return *this; }
+    Emitter &operator<<(unsigned long long v) { putUInt(v); return *this; }
+
+    // all of it to fd, false and errno set on failure
+    bool flush(int fd) const;
+    // create/truncate filename and flush to it
+    bool writeFile(const char *filename) const;
+    // a copy, for when a string is really needed
+    std::string str() const;
+
+private:
+    Emitter(const Emitter &) = delete;
+    Emitter &operator=(const Emitter &) = delete;
+
+    void nextChunk();
+    size_t used(size_t chunk) const;
+
+    std::vector<char*> _chunks;
+    size_t _cur;       // chunk we write to
+    size_t _chunkSize;
+    char *_pos, *_end; // in _chunks[_cur]
+};
+
+} // namespace Cmp
+
+#endif // EMITTER_H
@@ -1,135 +1,276 @@
 #include "generator.h"
+#include "x86encoder.h"
 #include <string>
-#include <sstream>
 #include <iostream>
 #include <cstdlib>
+#include <vector>
 
 using namespace Cmp;
 using namespace std;
 
 
-Generator::Generator(Parser *parser, Lexer *lex)
-    : _parser(parser)
-    , _lexer(lex)
-    , _epilogCalled(false)
+Generator::Generator(ostream &err, Target target, bool framePointer)
+    : _err(err)
+    , _code(target)
+    , _vbase(0)
+    , _blockNr(0)
+    , _framePointer(framePointer)
+    , _frame(true)
+    , _stackOnly(false)
+    , _functions(0)
+    , _frameless(0)
+    , _framelessEpilogs(0)
 { }
 
 Generator::~Generator()
 { }
 
-std::string Generator::generate(ParseNode *root)
-{
-    _res.clear();
-    _currentNode = root;
-    if (root)
-        visit();
-
-    return _res.str();
-}
-
-void Generator::visit()
-{
-    do {
-
-        switch(_currentNode->kind()) {
-        case ParseNode::Program:
-            programStart();
-            break;
-        case ParseNode::Function:
-            functionNode();  // calls this visit function recursively
-            break;
-        case ParseNode::Statement:
-            statementNode();
-            break;
-        case ParseNode::Return:
-            returnNode();
-            return ; //
-        case ParseNode::Expression:
-            continue;
-        case ParseNode::Constant:
-            constantInt();
-            break;
-        default:
-            cerr << "Unhandled ParseNode kind, sould never end up here. its a bug" << endl;
-            abort();
-        }
-    } while (next());
+bool Generator::generate(const IrProgram &ir)
+{
+    _code.clear();
+    _blockNr = 0;
+    _functions = _frameless = _framelessEpilogs = 0;
+    if (ir.functions().empty())
+        return false;
+
+    programStart();
+    for (const IrFunction &fn : ir.functions())
+        function(fn);
+
+    // temporaries to registers
+    RegAlloc alloc(_err, _stackOnly);
+    if (!alloc.run(_code))
+        return false;
+
+    return !_code.empty();
 }
 
+// shorthands for the instruction operands
+static inline Operand reg(Reg r) { return Operand::makeReg(r); }
+static inline Operand imm(int32_t v) { return Operand::makeImm(v); }
+
 void Generator::programStart()
 {
-    _res << "# assembler created by c-compiler by fredrikjohansson,"
-        << "example from norasandler let's build a c-compiler\n\n"
-        //<< "    .section\n " //__TEXT,__text_startup,regular,pure_instructions\n"
-        << "    .align 4\n"
-        << "    .text\n"
-        << "    .globl  main\n"
-        << "    .type   main, @function\n";
+    _code.directive("# assembler created by c-compiler by fredrikjohansson,"
+                    "example from norasandler let's build a c-compiler\n");
+    //_code.directive("    .section\n "); //__TEXT,__text_startup,regular,pure_instructions
+    _code.directive("    .align 4");
+    _code.directive("    .text");
+    _code.directive("    .globl  main");
+    _code.directive("    .type   main, @function");
 }
 
-void Generator::functionNode()
+void Generator::function(const IrFunction &fn)
 {
-    functionProlog();
-    next();
-    visit(); // recurse
-    if (!_epilogCalled)
-        functionEpilog();
+    // IR registers keep their numbers, moved up past earlier functions
+    _vbase = _code.virtualCount();
+    for (uint32_t i = 0; i < fn.vregs; ++i)
+        _code.newVirtual();
+
+    _blockLabels.resize(fn.blocks.size());
+    for (uint32_t b = 0; b < fn.blocks.size(); ++b)
+        _blockLabels[b] = _code.newLabel(".L_bb", 5, _blockNr + b);
+    _blockNr += static_cast<uint32_t>(fn.blocks.size());
+
+    functionProlog(fn);
+    for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+        if (b > 0)
+            _code.label(_blockLabels[b]);
+        for (uint32_t i = fn.blocks[b].begin; i < fn.blocks[b].end; ++i)
+            instruction(fn.insts[i], b + 1);
+    }
 }
 
-void Generator::functionProlog()
+// a frame is for locals, arguments and calls. The IR has none of them
+// yet so only a debugger needs one, spills are addressed off %esp
+bool Generator::needsFrame(const IrFunction &) const
 {
-    _epilogCalled = false;
-    _res << _currentNode->lexToken()->srcStr() << ":\n"
-        << "    # preamble\n"
-        << "    push %ebp\n"
-        << "    movl %esp, %ebp\n"
-        << "    # end preamble\n";
+    return _framePointer;
 }
 
-void Generator::functionEpilog()
+void Generator::functionProlog(const IrFunction &fn)
 {
-    _epilogCalled = true;
-    _res << "    #epilog\n"
-         << "    movl %ebp, %esp\n"
-         << "    popl %ebp\n"
-         << "    ret\n";
+    _code.label(_code.newFunction(fn.name, fn.len));
+    ++_functions;
+    _frame = needsFrame(fn);
+    if (!_frame) {
+        ++_frameless;
+        return;
+    }
+    _code.comment("preamble");
+    _code.emit(Inst::Push, reg(Ebp));
+    _code.emit(Inst::Mov, reg(Ebp), reg(Esp));
+    _code.comment("end preamble");
 }
 
-void Generator::statementNode()
+void Generator::functionEpilog()
 {
+    _code.comment("epilog");
+    if (_frame) {
+        _code.emit(Inst::Mov, reg(Esp), reg(Ebp));
+        _code.emit(Inst::Pop, reg(Ebp));
+    } else
+        ++_framelessEpilogs;
+    _code.emit(Inst::Ret);
 }
 
-void Generator::returnNode()
+void Generator::frameReport(ostream &out) const
 {
-    next();
-    visit();
-    _res << "    # return\n"
-         << "    popl %eax\n";
-    functionEpilog();
+    // what the frame code takes for this target, encoded to count bytes
+    InstList prolog(_code.target()), epilog(_code.target());
+    prolog.emit(Inst::Push, reg(Ebp));
+    prolog.emit(Inst::Mov, reg(Ebp), reg(Esp));
+    epilog.emit(Inst::Mov, reg(Esp), reg(Ebp));
+    epilog.emit(Inst::Pop, reg(Ebp));
+    X86Encoder encoder(_err, _code.target() == TargetX86_64 ? X86Encoder::Mode64 : X86Encoder::Mode32);
+    vector<uint8_t> prologBytes, epilogBytes;
+    encoder.encode(prolog, prologBytes);
+    encoder.encode(epilog, epilogBytes);
+
+    out << "frames left out in " << _frameless << " of " << _functions << " functions, "
+        << 2 * (_frameless + _framelessEpilogs) << " instructions, "
+        << _frameless * prologBytes.size() + _framelessEpilogs * epilogBytes.size() << " bytes saved\n";
 }
 
-void Generator::constantInt()
+void Generator::instruction(const IrInst &inst, uint32_t nextBlock)
 {
-    _res << "    # expressionNode\n";
-    switch (_currentNode->lexToken()->type) {
-    case LexToken::IntLitteral:
-        _res << "    pushl $" << std::stoi(_currentNode->lexToken()->srcStr(), nullptr, 10) << "\n";
+    if (!inst.isTerminator())
+        _code.comment(IrInst::op_to_cstr(inst.op));
+
+    switch (inst.op) {
+    case IrInst::Copy:
+        _code.emit(Inst::Mov, dst(inst), value(inst.a));
+        break;
+    case IrInst::Neg: case IrInst::Not:
+        unaryOp(inst);
+        break;
+    case IrInst::Div: case IrInst::Mod:
+        divide(inst);
         break;
-    case LexToken::OctalLitteral:
-        _res << "    push $" << std::stoi(_currentNode->lexToken()->srcStr(), nullptr, 8) << "\n";
+    case IrInst::Eq: case IrInst::Ne: case IrInst::Lt:
+    case IrInst::Le: case IrInst::Gt: case IrInst::Ge:
+        compare(inst);
         break;
-    case LexToken::BinaryLitteral:
-        _res << "    push $" << std::stoi(_currentNode->lexToken()->srcStr(), nullptr, 2) << "\n";
+    case IrInst::Jmp:
+        jump(inst.target[0], nextBlock);
         break;
-    case LexToken::HexLitteral:
-        _res << "    push $" << std::stoi(_currentNode->lexToken()->srcStr(), nullptr, 16) << "\n";
+    case IrInst::Br:
+        branch(inst, nextBlock);
         break;
+    case IrInst::Ret:
+        _code.comment("return");
+        _code.emit(Inst::Mov, reg(Eax), value(inst.a));
+        functionEpilog();
+        break;
+    default:
+        binaryOp(inst);
+    }
+}
+
+void Generator::unaryOp(const IrInst &inst)
+{
+    Operand d = dst(inst);
+    _code.emit(Inst::Mov, d, value(inst.a));
+    _code.emit(inst.op == IrInst::Neg ? Inst::Neg : Inst::Not, d);
+}
+
+void Generator::binaryOp(const IrInst &inst)
+{
+    Inst::Op op;
+    switch (inst.op) {
+    case IrInst::Add: op = Inst::Add; break;
+    case IrInst::Sub: op = Inst::Sub; break;
+    case IrInst::Mul: op = Inst::Imul; break;
+    case IrInst::And: op = Inst::And; break;
+    case IrInst::Or: op = Inst::Or; break;
+    case IrInst::Xor: op = Inst::Xor; break;
+    case IrInst::Shl: op = Inst::Shl; break;
+    case IrInst::Sar: op = Inst::Sar; break;
     default:
-        cout << "Error ParseNode LexToken->type not handled\n";
+        _err << "Error IR op " << IrInst::op_to_cstr(inst.op) << " not handled\n";
+        return;
+    }
+
+    // x86 is two address, dst = a first. Save b if that overwrites it
+    Operand d = dst(inst), b = value(inst.b);
+    if (inst.b.isVReg(inst.dst)) {
+        b = Operand::makeVirtual(_code.newVirtual());
+        _code.emit(Inst::Mov, b, d);
+    }
+    _code.emit(Inst::Mov, d, value(inst.a));
+    if ((op == Inst::Shl || op == Inst::Sar) && b.kind != Operand::Imm) {
+        _code.emit(Inst::Mov, reg(Ecx), b); // count in %cl
+        b = reg(Ecx);
     }
+    _code.emit(op, d, b);
+}
+
+void Generator::divide(const IrInst &inst)
+{
+    // idiv wants its dividend in %edx:%eax and the divisor in a register
+    Operand b = inRegister(inst.b);
+    _code.emit(Inst::Mov, reg(Eax), value(inst.a));
+    _code.emit(Inst::Cdq);
+    _code.emit(Inst::Idiv, b);
+    _code.emit(Inst::Mov, dst(inst), reg(inst.op == IrInst::Mod ? Edx : Eax));
+}
+
+void Generator::compare(const IrInst &inst)
+{
+    Cond cond;
+    switch (inst.op) {
+    case IrInst::Eq: cond = CondE; break;
+    case IrInst::Ne: cond = CondNE; break;
+    case IrInst::Lt: cond = CondL; break;
+    case IrInst::Le: cond = CondLE; break;
+    case IrInst::Gt: cond = CondG; break;
+    default: cond = CondGE; break;
+    }
+    _code.emit(Inst::Cmp, inRegister(inst.a), value(inst.b));
+    _code.emit(Inst::Setcc, cond, reg(Eax));
+    _code.emit(Inst::Movzb, dst(inst), reg(Eax));
+}
+
+// falls through when the target is next
+void Generator::branch(const IrInst &inst, uint32_t nextBlock)
+{
+    if (inst.a.kind == IrValue::Imm) {
+        jump(inst.target[inst.a.value ? 0 : 1], nextBlock);
+        return;
+    }
+    _code.emit(Inst::Cmp, value(inst.a), imm(0));
+    if (inst.target[0] == nextBlock) {
+        _code.emit(Inst::Jcc, CondE, Operand::makeLabel(_blockLabels[inst.target[1]]));
+    } else {
+        _code.emit(Inst::Jcc, CondNE, Operand::makeLabel(_blockLabels[inst.target[0]]));
+        jump(inst.target[1], nextBlock);
+    }
+}
+
+void Generator::jump(uint32_t block, uint32_t nextBlock)
+{
+    if (block != nextBlock)
+        _code.emit(Inst::Jmp, Operand::makeLabel(_blockLabels[block]));
+}
+
+Operand Generator::value(const IrValue &v) const
+{
+    if (v.kind == IrValue::Imm)
+        return imm(v.value);
+    return Operand::makeVirtual(_vbase + static_cast<uint32_t>(v.value));
+}
+
+Operand Generator::dst(const IrInst &inst) const
+{
+    return Operand::makeVirtual(_vbase + inst.dst);
 }
 
-bool Generator::next()
+// most instructions take a constant as source only
+Operand Generator::inRegister(const IrValue &v)
 {
-    return _currentNode && (_currentNode = _currentNode->operat());
+    if (v.kind != IrValue::Imm)
+        return value(v);
+    Operand r = Operand::makeVirtual(_code.newVirtual());
+    _code.emit(Inst::Mov, r, imm(v.value));
+    return r;
 }
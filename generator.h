@@ -1,42 +1,68 @@
 #ifndef GENERATOR_H
 #define GENERATOR_H
 
-#include <string>
-#include <sstream>
+#include <ostream>
+#include <vector>
 
-#include "parser.h"
+#include "ir.h"
+#include "instlist.h"
+#include "regalloc.h"
 
 namespace Cmp {
 
 
-/// goal of this class is to generate asm code from the parsetree
+/// goal of this class is to generate asm code from the IR, each IR
+/// instruction becomes a few x86 ones on virtual registers, RegAlloc
+/// picks the real registers when all is done.
+/// i386 and x86-64 get the same instructions, the target decides the
+/// register sets and the width of the frame and stack pointers.
+/// Functions only get a %ebp frame when they need one or framePointer
+/// asks for it (-g), leaf functions go without
 class Generator
 {
-    Parser *_parser;
-    Lexer  *_lexer;
-    std::stringstream _res;
-    ParseNode *_currentNode;
-    bool _epilogCalled;
+    std::ostream &_err;
+    InstList _code;
+    uint32_t _vbase;        // InstList virtual register for IR register 0
+    uint32_t _blockNr;      // numbers block labels over all functions
+    std::vector<InstList::LabelId> _blockLabels;
+    bool _framePointer;     // every function gets a frame, for debuggers
+    bool _frame;            // the function being generated has one
+    bool _stackOnly;        // no register allocation, temporaries on the stack
+    // frames left out, for the size report
+    size_t _functions, _frameless, _framelessEpilogs;
 public:
-    explicit Generator(Parser* parser, Lexer *lex);
+    explicit Generator(std::ostream &err, Target target = TargetI386, bool framePointer = false);
     virtual ~Generator();
 
-    std::string generate(ParseNode *root);
+    // false if nothing was generated, the instructions are in code()
+    // with registers allocated
+    bool generate(const IrProgram &ir);
+    // every temporary in a stack slot, slower code to compare against
+    void setStackOnly(bool stackOnly) { _stackOnly = stackOnly; }
+    const InstList &code() const { return _code; }
+    InstList &code() { return _code; }
+
+    // how many functions went without a frame and the instructions and
+    // bytes that saved
+    void frameReport(std::ostream &out) const;
 
 private:
-    void visit();                                           // in post order
-                                                            //  (3)op         * <- op last
-                                                            //    /  \        *
-                                                            //(1)id (2)vlu    *
     void programStart();
-    void functionNode();
-    void functionProlog();
+    void function(const IrFunction &fn);
+    bool needsFrame(const IrFunction &fn) const;
+    void functionProlog(const IrFunction &fn);
     void functionEpilog();
-    void statementNode();
-    void returnNode();
-    void constantInt();
+    void instruction(const IrInst &inst, uint32_t nextBlock);
+    void unaryOp(const IrInst &inst);
+    void binaryOp(const IrInst &inst);
+    void divide(const IrInst &inst);
+    void compare(const IrInst &inst);
+    void branch(const IrInst &inst, uint32_t nextBlock);
+    void jump(uint32_t block, uint32_t nextBlock);
 
-    bool next();
+    Operand value(const IrValue &v) const;
+    Operand dst(const IrInst &inst) const;
+    Operand inRegister(const IrValue &v);
 };
 
 } // namespace Cmp
@@ -0,0 +1,236 @@
+#include "instlist.h"
+#include "emitter.h"
+#include <cstring>
+#include <cassert>
+
+using namespace Cmp;
+using namespace std;
+
+namespace {
+
+const char *const _regNames[] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+                                  "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d" };
+const char *const _wideRegNames[] = { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+                                      "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15" };
+const char *const _byteRegNames[] = { "al", "cl", "dl", "bl" };
+
+const char *condName(Cond cc)
+{
+    switch (cc) {
+    case CondE: return "e";
+    case CondNE: return "ne";
+    case CondL: return "l";
+    case CondGE: return "ge";
+    case CondLE: return "le";
+    case CondG: return "g";
+    }
+    return "?";
+}
+
+// AT&T mnemonics, l suffix for 32bit
+const char *mnemonic(Inst::Op op)
+{
+    switch (op) {
+    case Inst::Push: return "pushl";
+    case Inst::Pop: return "popl";
+    case Inst::Mov: return "movl";
+    case Inst::Add: return "addl";
+    case Inst::Sub: return "subl";
+    case Inst::Imul: return "imull";
+    case Inst::And: return "andl";
+    case Inst::Or: return "orl";
+    case Inst::Xor: return "xorl";
+    case Inst::Cmp: return "cmpl";
+    case Inst::Neg: return "negl";
+    case Inst::Not: return "notl";
+    case Inst::Cdq: return "cltd";
+    case Inst::Idiv: return "idivl";
+    case Inst::Shl: return "sall";
+    case Inst::Sar: return "sarl";
+    case Inst::Movzb: return "movzbl";
+    case Inst::Jmp: return "jmp";
+    case Inst::Call: return "call";
+    case Inst::Ret: return "ret";
+    default: ;
+    }
+    return nullptr;
+}
+
+} // namespace
+
+const InstList::LabelId InstList::NoLabel;
+
+InstList::InstList(Target target)
+    : _virtuals(0)
+    , _target(target)
+    , _text(4 * 1024)
+{ }
+
+void InstList::clear()
+{
+    _insts.clear();
+    _labels.clear();
+    _virtuals = 0;
+    _text.reset();
+}
+
+size_t InstList::instructionCount() const
+{
+    size_t n = 0;
+    for (const Inst &inst : _insts) {
+        if (inst.op != Inst::Label && inst.op != Inst::Comment && inst.op != Inst::Directive)
+            ++n;
+    }
+    return n;
+}
+
+InstList::LabelId InstList::newLabel(const char *name, size_t len, int64_t nr)
+{
+    _labels.push_back(LabelInfo{ name, static_cast<uint32_t>(len), nr, false });
+    return static_cast<LabelId>(_labels.size() - 1);
+}
+
+InstList::LabelId InstList::newFunction(const char *name, size_t len)
+{
+    _labels.push_back(LabelInfo{ name, static_cast<uint32_t>(len), -1, true });
+    return static_cast<LabelId>(_labels.size() - 1);
+}
+
+InstList::LabelId InstList::findLabel(const char *name) const
+{
+    size_t len = strlen(name);
+    for (LabelId i = 0; i < _labels.size(); ++i) {
+        if (_labels[i].nr < 0 && _labels[i].len == len &&
+            memcmp(_labels[i].name, name, len) == 0)
+        {
+            return i;
+        }
+    }
+    return NoLabel;
+}
+
+void InstList::label(LabelId id)
+{
+    emit(Inst::Label, Operand::makeLabel(id));
+}
+
+void InstList::comment(const char *text, const char *extra, size_t extraLen)
+{
+    size_t len = strlen(text);
+    char *mem = static_cast<char*>(_text.allocate(len + extraLen, 1));
+    memcpy(mem, text, len);
+    if (extraLen)
+        memcpy(mem + len, extra, extraLen);
+
+    Inst inst = { Inst::Comment, CondE, Operand::makeNone(), Operand::makeNone(),
+                  mem, static_cast<uint32_t>(len + extraLen) };
+    _insts.push_back(inst);
+}
+
+void InstList::directive(const char *text)
+{
+    Inst inst = { Inst::Directive, CondE, Operand::makeNone(), Operand::makeNone(),
+                  text, static_cast<uint32_t>(strlen(text)) };
+    _insts.push_back(inst);
+}
+
+void InstList::emit(Inst::Op op, Operand dst, Operand src)
+{
+    Inst inst = { op, CondE, dst, src, nullptr, 0 };
+    _insts.push_back(inst);
+}
+
+void InstList::emit(Inst::Op op, Cond cond, Operand dst)
+{
+    Inst inst = { op, cond, dst, Operand::makeNone(), nullptr, 0 };
+    _insts.push_back(inst);
+}
+
+void InstList::printOperand(Emitter &out, const Operand &o, bool byte, bool wide) const
+{
+    switch (o.kind) {
+    case Operand::Register:
+        assert(!byte || o.reg < 4);
+        out << '%' << (byte ? _byteRegNames[o.reg] : wide ? _wideRegNames[o.reg] : _regNames[o.reg]);
+        break;
+    case Operand::Imm:
+        out << '$' << o.value;
+        break;
+    case Operand::Mem:
+        if (o.value)
+            out << o.value;
+        // addresses are as wide as the pointers
+        out << "(%" << (_target == TargetX86_64 ? _wideRegNames[o.reg] : _regNames[o.reg]) << ')';
+        break;
+    case Operand::Label: {
+        const LabelInfo &l = _labels[static_cast<LabelId>(o.value)];
+        out.write(l.name, l.len);
+        if (l.nr >= 0)
+            out << l.nr;
+    } break;
+    case Operand::Virtual:
+        out << "%v" << o.value;
+        break;
+    case Operand::None: break;
+    }
+}
+
+void InstList::to_asm(Emitter &out) const
+{
+    for (const Inst &inst : _insts) {
+        switch (inst.op) {
+        case Inst::Label:
+            printOperand(out, inst.dst);
+            out << ":\n";
+            continue;
+        case Inst::Comment:
+            out << "    # ";
+            out.write(inst.text, inst.textLen);
+            out << '\n';
+            continue;
+        case Inst::Directive:
+            out.write(inst.text, inst.textLen);
+            out << '\n';
+            continue;
+        case Inst::Setcc:
+            out << "    set" << condName(inst.cond) << ' ';
+            printOperand(out, inst.dst, true);
+            out << '\n';
+            continue;
+        case Inst::Jcc:
+            out << "    j" << condName(inst.cond) << ' ';
+            printOperand(out, inst.dst);
+            out << '\n';
+            continue;
+        default: ;
+        }
+
+        // on x86-64 push, pop and anything on %rsp/%rbp is 64bit, q not l
+        bool wide = _target == TargetX86_64 &&
+                    (inst.op == Inst::Push || inst.op == Inst::Pop ||
+                     inst.dst.isReg(Esp) || inst.dst.isReg(Ebp) ||
+                     inst.src.isReg(Esp) || inst.src.isReg(Ebp));
+        const char *name = mnemonic(inst.op);
+        out << "    ";
+        if (wide) {
+            out.write(name, strlen(name) - 1);
+            out << 'q';
+        } else
+            out << name;
+
+        // AT&T order, source first
+        if (inst.src.kind != Operand::None) {
+            out << ' ';
+            bool byteSrc = inst.op == Inst::Movzb ||
+                           ((inst.op == Inst::Shl || inst.op == Inst::Sar) &&
+                            inst.src.kind == Operand::Register);
+            printOperand(out, inst.src, byteSrc, wide);
+            out << ',';
+        }
+        if (inst.dst.kind != Operand::None) {
+            out << ' ';
+            printOperand(out, inst.dst, false, wide);
+        }
+        out << '\n';
+    }
+}
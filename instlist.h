@@ -0,0 +1,133 @@
+#ifndef INSTLIST_H
+#define INSTLIST_H
+
+#include <inttypes.h>
+#include <cstddef>
+#include <vector>
+#include "astarena.h"
+
+namespace Cmp {
+
+class Emitter;
+
+// x86 registers, numbered as in the instruction encoding. R8-R15 are
+// x86-64 only, a REX prefix carries their top bit
+enum Reg : uint8_t {
+    Eax, Ecx, Edx, Ebx, Esp, Ebp, Esi, Edi,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+    NoReg = 0xFF
+};
+
+// what the code is for. Values are 32bit ints on both, on x86-64 the
+// stack and frame pointers and push/pop are 64bit
+enum Target : uint8_t { TargetI386, TargetX86_64 };
+
+// condition codes, the low nibble of jcc/setcc
+enum Cond : uint8_t {
+    CondE = 0x4, CondNE = 0x5, CondL = 0xC, CondGE = 0xD, CondLE = 0xE, CondG = 0xF
+};
+
+struct Operand {
+    enum Kind : uint8_t { None, Register, Imm, Mem, Label, Virtual };
+    Kind kind;
+    Reg reg;       // Register, base of Mem
+    int32_t value; // Imm, displacement of Mem, label id, virtual register nr
+
+    static Operand makeNone() { return Operand{ None, NoReg, 0 }; }
+    static Operand makeReg(Reg r) { return Operand{ Register, r, 0 }; }
+    static Operand makeImm(int32_t v) { return Operand{ Imm, NoReg, v }; }
+    static Operand makeMem(Reg base, int32_t disp) { return Operand{ Mem, base, disp }; }
+    static Operand makeLabel(uint32_t id) { return Operand{ Label, NoReg, static_cast<int32_t>(id) }; }
+    // until RegAlloc has given it a register or a stack slot
+    static Operand makeVirtual(uint32_t nr) { return Operand{ Virtual, NoReg, static_cast<int32_t>(nr) }; }
+    bool isReg(Reg r) const { return kind == Register && reg == r; }
+    bool isVirtual(uint32_t nr) const { return kind == Virtual && static_cast<uint32_t>(value) == nr; }
+};
+
+// one instruction, Intel operand order (dst, src). The op decides the
+// width, Setcc/Movzb use the low byte of their byte operand
+struct Inst {
+    enum Op : uint8_t {
+        Label, Comment, Directive,
+        Push, Pop, Mov, Add, Sub, Imul, And, Or, Xor, Cmp,
+        Neg, Not, Cdq, Idiv, Shl, Sar, Setcc, Movzb,
+        Jmp, Jcc, Call, Ret
+    };
+    Op op;
+    Cond cond;      // Setcc, Jcc
+    Operand dst, src;
+    const char *text; // Comment, Directive
+    uint32_t textLen;
+};
+
+// the code for a program as a list of instructions, the generator fills
+// it, to_asm() prints it for gas and the encoder turns it into bytes
+class InstList
+{
+public:
+    typedef uint32_t LabelId;
+    static const LabelId NoLabel = 0xFFFFFFFF;
+
+    // label name, printed as name followed by nr when nr >= 0
+    struct LabelInfo {
+        const char *name;
+        uint32_t len;
+        int64_t nr;
+        bool function; // starts a function
+    };
+
+    explicit InstList(Target target = TargetI386);
+
+    Target target() const { return _target; }
+    void setTarget(Target target) { _target = target; }
+
+    void clear();
+    size_t size() const { return _insts.size(); }
+    bool empty() const { return _insts.empty(); }
+    size_t instructionCount() const; // no labels, comments or directives
+    const Inst &operator[](size_t i) const { return _insts[i]; }
+    Inst &operator[](size_t i) { return _insts[i]; }
+    std::vector<Inst>::const_iterator begin() const { return _insts.begin(); }
+    std::vector<Inst>::const_iterator end() const { return _insts.end(); }
+    // for passes that rewrite the list
+    std::vector<Inst> &instructions() { return _insts; }
+
+    // name must outlive the list
+    LabelId newLabel(const char *name, size_t len, int64_t nr = -1);
+    LabelId newFunction(const char *name, size_t len);
+    const LabelInfo &labelInfo(LabelId id) const { return _labels[id]; }
+    size_t labelCount() const { return _labels.size(); }
+    // a named label without nr, NoLabel if there is none
+    LabelId findLabel(const char *name) const;
+
+    // a new virtual register, numbered from 0 for the whole list
+    uint32_t newVirtual() { return _virtuals++; }
+    uint32_t virtualCount() const { return _virtuals; }
+
+    void label(LabelId id);
+    // text is copied, extra is appended to it
+    void comment(const char *text, const char *extra = nullptr, size_t extraLen = 0);
+    // static text, printed as is
+    void directive(const char *text);
+    void emit(Inst::Op op, Operand dst = Operand::makeNone(), Operand src = Operand::makeNone());
+    void emit(Inst::Op op, Cond cond, Operand dst);
+
+    // AT&T syntax for the gnu assembler, for the target
+    void to_asm(Emitter &out) const;
+
+private:
+    InstList(const InstList &) = delete;
+    InstList &operator=(const InstList &) = delete;
+
+    void printOperand(Emitter &out, const Operand &o, bool byte = false, bool wide = false) const;
+
+    std::vector<Inst> _insts;
+    std::vector<LabelInfo> _labels;
+    uint32_t _virtuals;
+    Target _target;
+    AstArena _text; // comment texts
+};
+
+} // namespace Cmp
+
+#endif // INSTLIST_H
@@ -0,0 +1,76 @@
+#include "interner.h"
+#include <cstring>
+
+using namespace Cmp;
+using namespace std;
+
+const Interner::SymbolId Interner::NoSymbol;
+
+Interner::Interner()
+    : _chars(16 * 1024)
+    , _slots(256, NoSymbol)
+{ }
+
+uint32_t Interner::hash(const char *str, size_t len)
+{
+    // FNV-1a, identifiers are short
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; ++i)
+        h = (h ^ static_cast<uint8_t>(str[i])) * 16777619u;
+    return h;
+}
+
+size_t Interner::slotFor(const char *str, size_t len, uint32_t h) const
+{
+    // linear probing, stops at the name or an empty slot
+    size_t mask = _slots.size() - 1;
+    for (size_t i = h & mask; ; i = (i + 1) & mask) {
+        SymbolId id = _slots[i];
+        if (id == NoSymbol)
+            return i;
+        const Entry &e = _entries[id];
+        if (e.hash == h && e.len == len && memcmp(e.str, str, len) == 0)
+            return i;
+    }
+}
+
+Interner::SymbolId Interner::find(const char *str, size_t len) const
+{
+    return _slots[slotFor(str, len, hash(str, len))];
+}
+
+Interner::SymbolId Interner::intern(const char *str, size_t len)
+{
+    uint32_t h = hash(str, len);
+    size_t slot = slotFor(str, len, h);
+    if (_slots[slot] != NoSymbol)
+        return _slots[slot];
+
+    // keep the load below 1/2
+    if ((_entries.size() + 1) * 2 > _slots.size()) {
+        grow();
+        slot = slotFor(str, len, h);
+    }
+
+    char *mem = static_cast<char*>(_chars.allocate(len + 1, 1));
+    memcpy(mem, str, len);
+    mem[len] = 0;
+
+    SymbolId id = static_cast<SymbolId>(_entries.size());
+    _entries.push_back(Entry{ mem, static_cast<uint32_t>(len), h });
+    _slots[slot] = id;
+    return id;
+}
+
+void Interner::grow()
+{
+    vector<SymbolId> slots(_slots.size() * 2, NoSymbol);
+    size_t mask = slots.size() - 1;
+    for (SymbolId id = 0; id < _entries.size(); ++id) {
+        size_t i = _entries[id].hash & mask;
+        while (slots[i] != NoSymbol)
+            i = (i + 1) & mask;
+        slots[i] = id;
+    }
+    _slots.swap(slots);
+}
@@ -0,0 +1,48 @@
+#ifndef INTERNER_H
+#define INTERNER_H
+
+#include <inttypes.h>
+#include <cstddef>
+#include <vector>
+#include "astarena.h"
+
+namespace Cmp {
+
+// gives each distinct identifier a dense 32bit id, the first one seen
+// gets 0 and so on. Same name, same id, so names compare as integers.
+// The chars are copied, ids and str() stay valid when the source is gone.
+class Interner
+{
+public:
+    typedef uint32_t SymbolId;
+    static const SymbolId NoSymbol = 0xFFFFFFFF;
+
+    explicit Interner();
+
+    SymbolId intern(const char *str, size_t len);
+    // NoSymbol if never interned
+    SymbolId find(const char *str, size_t len) const;
+
+    size_t size() const { return _entries.size(); }
+    // NUL terminated
+    const char *str(SymbolId id) const { return _entries[id].str; }
+    size_t len(SymbolId id) const { return _entries[id].len; }
+
+private:
+    struct Entry {
+        const char *str;
+        uint32_t len, hash;
+    };
+
+    static uint32_t hash(const char *str, size_t len);
+    size_t slotFor(const char *str, size_t len, uint32_t h) const;
+    void grow();
+
+    AstArena _chars;              // the names, never moved
+    std::vector<Entry> _entries;  // indexed by SymbolId
+    std::vector<SymbolId> _slots; // open addressing, power of 2 size
+};
+
+} // namespace Cmp
+
+#endif // INTERNER_H
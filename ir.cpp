@@ -0,0 +1,174 @@
+#include "ir.h"
+#include <sstream>
+
+using namespace Cmp;
+using namespace std;
+
+namespace {
+
+void printValue(stringstream &out, const IrValue &v)
+{
+    if (v.kind == IrValue::VReg)
+        out << '%' << v.value;
+    else
+        out << v.value;
+}
+
+// operands an op takes, a first
+size_t operandCount(IrInst::Op op)
+{
+    if (op <= IrInst::Not || op == IrInst::Br || op == IrInst::Ret)
+        return 1;
+    return op == IrInst::Jmp ? 0 : 2;
+}
+
+size_t targetCount(IrInst::Op op)
+{
+    return op == IrInst::Br ? 2 : op == IrInst::Jmp ? 1 : 0;
+}
+
+} // namespace
+
+const char *IrInst::op_to_cstr(Op op)
+{
+    switch (op) {
+    case Copy: return "copy";
+    case Neg: return "neg";
+    case Not: return "not";
+    case Add: return "add";
+    case Sub: return "sub";
+    case Mul: return "mul";
+    case Div: return "div";
+    case Mod: return "mod";
+    case And: return "and";
+    case Or: return "or";
+    case Xor: return "xor";
+    case Shl: return "shl";
+    case Sar: return "sar";
+    case Eq: return "eq";
+    case Ne: return "ne";
+    case Lt: return "lt";
+    case Le: return "le";
+    case Gt: return "gt";
+    case Ge: return "ge";
+    case Jmp: return "jmp";
+    case Br: return "br";
+    case Ret: return "ret";
+    }
+    return "?";
+}
+
+IrProgram::IrProgram()
+{ }
+
+size_t IrProgram::instructionCount() const
+{
+    size_t n = 0;
+    for (const IrFunction &fn : _functions)
+        n += fn.insts.size();
+    return n;
+}
+
+bool IrProgram::verify(ostream &err) const
+{
+    bool ok = true;
+    for (const IrFunction &fn : _functions) {
+        string name(fn.name, fn.len);
+        if (fn.blocks.empty()) {
+            err << "ir: " << name << " has no blocks\n";
+            ok = false;
+            continue;
+        }
+
+        size_t b = 0, i = 0;
+        auto fail = [&](const char *msg) {
+            err << "ir: " << name << " bb" << b << " instruction " << i << ": " << msg << "\n";
+            ok = false;
+        };
+
+        // in layout order, so set before use is a linear check
+        vector<bool> defined(fn.vregs, false);
+        uint32_t expect = 0;
+        for (b = 0; b < fn.blocks.size(); ++b) {
+            const IrBlock &blk = fn.blocks[b];
+            if (blk.begin != expect || blk.end <= blk.begin || blk.end > fn.insts.size()) {
+                i = blk.begin;
+                fail("blocks don't cover the instructions in order");
+                break;
+            }
+            expect = blk.end;
+
+            for (i = blk.begin; i < blk.end; ++i) {
+                const IrInst &inst = fn.insts[i];
+                bool last = i + 1 == blk.end;
+                if (inst.isTerminator() != last)
+                    fail(last ? "block doesn't end with jmp, br or ret" : "jmp, br or ret inside a block");
+
+                const IrValue *vals[] = { &inst.a, &inst.b };
+                for (size_t k = 0; k < 2; ++k) {
+                    const IrValue &v = *vals[k];
+                    if ((k < operandCount(inst.op)) != (v.kind != IrValue::None))
+                        fail("wrong number of operands");
+                    else if (v.kind == IrValue::VReg &&
+                             (static_cast<uint32_t>(v.value) >= fn.vregs || !defined[static_cast<size_t>(v.value)]))
+                        fail("register used before it is set");
+                }
+
+                if (inst.isTerminator()) {
+                    if (inst.type != Void)
+                        fail("jmp, br or ret with a type");
+                } else if (inst.type != I32) {
+                    fail("value without a type");
+                } else if (inst.dst >= fn.vregs) {
+                    fail("register out of range");
+                } else
+                    defined[inst.dst] = true;
+
+                // the register allocator counts on it
+                for (size_t t = 0; t < targetCount(inst.op); ++t) {
+                    if (inst.target[t] <= b || inst.target[t] >= fn.blocks.size())
+                        fail("jump target is not a later block");
+                }
+            }
+        }
+        if (ok && expect != fn.insts.size()) {
+            b = fn.blocks.size() - 1;
+            fail("instructions after the last block");
+        }
+    }
+    return ok;
+}
+
+string IrProgram::to_string() const
+{
+    stringstream out;
+    for (const IrFunction &fn : _functions) {
+        out << "function ";
+        out.write(fn.name, fn.len);
+        out << " (" << fn.vregs << " registers)\n";
+        for (size_t b = 0; b < fn.blocks.size(); ++b) {
+            out << "bb" << b << ":\n";
+            for (uint32_t i = fn.blocks[b].begin; i < fn.blocks[b].end && i < fn.insts.size(); ++i) {
+                const IrInst &inst = fn.insts[i];
+                out << "    ";
+                if (!inst.isTerminator())
+                    out << '%' << inst.dst << " = ";
+                out << IrInst::op_to_cstr(inst.op);
+                if (inst.type == I32 || inst.op == IrInst::Ret)
+                    out << " i32";
+                if (inst.a.kind != IrValue::None) {
+                    out << ' ';
+                    printValue(out, inst.a);
+                }
+                if (inst.b.kind != IrValue::None) {
+                    out << ", ";
+                    printValue(out, inst.b);
+                }
+                for (size_t t = 0; t < targetCount(inst.op); ++t)
+                    out << (t || inst.a.kind != IrValue::None ? ", bb" : " bb") << inst.target[t];
+                out << '\n';
+            }
+        }
+    }
+    return out.str();
+}
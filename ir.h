@@ -0,0 +1,86 @@
+#ifndef IR_H
+#define IR_H
+
+#include <inttypes.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <ostream>
+
+namespace Cmp {
+
+// an operand, a virtual register or a 32bit constant
+struct IrValue {
+    enum Kind : uint8_t { None, VReg, Imm };
+    Kind kind;
+    int32_t value; // register nr or the constant
+
+    static IrValue makeNone() { return IrValue{ None, 0 }; }
+    static IrValue makeVReg(uint32_t nr) { return IrValue{ VReg, static_cast<int32_t>(nr) }; }
+    static IrValue makeImm(int32_t v) { return IrValue{ Imm, v }; }
+    bool isVReg(uint32_t nr) const { return kind == VReg && static_cast<uint32_t>(value) == nr; }
+};
+
+enum IrType : uint8_t { Void, I32 };
+
+// three address instruction, dst = a op b
+struct IrInst {
+    enum Op : uint8_t {
+        Copy, Neg, Not,             // dst = op a
+        Add, Sub, Mul, Div, Mod,    // dst = a op b
+        And, Or, Xor, Shl, Sar,
+        Eq, Ne, Lt, Le, Gt, Ge,     // dst = a op b ? 1 : 0
+        Jmp, Br, Ret                // end every block, nothing else may
+    };
+    Op op;
+    IrType type;        // of dst, Void for the block enders
+    uint32_t dst;       // virtual register
+    IrValue a, b;       // Br tests a, Ret returns a
+    uint32_t target[2]; // Jmp to target[0], Br to target[0] if a != 0 else target[1]
+
+    bool isTerminator() const { return op >= Jmp; }
+    static const char *op_to_cstr(Op op);
+};
+
+// instructions [begin, end) of the function
+struct IrBlock {
+    uint32_t begin, end;
+};
+
+// one flat instruction array cut into blocks, they are in layout order
+// and a block falls through to the next only by a Jmp to it.
+// Registers are numbered per function and may be set more than once,
+// && and || set their result in two blocks.
+struct IrFunction {
+    const char *name; // owned by the interner
+    uint32_t len;
+    uint32_t vregs;   // registers used are 0..vregs-1
+    std::vector<IrInst> insts;
+    std::vector<IrBlock> blocks;
+};
+
+// the whole translation unit, IrBuilder fills it from the FlatAst,
+// the Generator lowers it to x86
+class IrProgram
+{
+public:
+    explicit IrProgram();
+
+    void clear() { _functions.clear(); }
+    std::vector<IrFunction> &functions() { return _functions; }
+    const std::vector<IrFunction> &functions() const { return _functions; }
+    size_t instructionCount() const;
+
+    // checks blocks, operands, types and that every register is set
+    // before it is used. Reports each problem to err
+    bool verify(std::ostream &err) const;
+
+    std::string to_string() const; // the -ir dump
+
+private:
+    std::vector<IrFunction> _functions;
+};
+
+} // namespace Cmp
+
+#endif // IR_H
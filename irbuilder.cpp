@@ -0,0 +1,292 @@
+#include "irbuilder.h"
+#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+
+using namespace Cmp;
+using namespace std;
+
+// shorthands for the operands
+static inline IrValue imm(int32_t v) { return IrValue::makeImm(v); }
+static inline IrValue none() { return IrValue::makeNone(); }
+
+IrBuilder::IrBuilder(Lexer *lex)
+    : _lexer(lex)
+    , _ast(nullptr)
+    , _cur(FlatAst::NoNode)
+    , _ir(nullptr)
+    , _fn(nullptr)
+    , _block(0)
+    , _failed(false)
+{ }
+
+bool IrBuilder::build(const FlatAst &ast, IrProgram &ir)
+{
+    ir.clear();
+    _ir = &ir;
+    _fn = nullptr;
+    _failed = false;
+    _values.clear();
+    _logic.clear();
+    _ast = &ast;
+    _cur = ast.root();
+    if (_cur != FlatAst::NoNode)
+        visit();
+
+    return !_failed;
+}
+
+void IrBuilder::visit()
+{
+    do {
+
+        switch(_ast->kind(_cur)) {
+        case ParseNode::Program:
+        case ParseNode::Statement:
+            break;
+        case ParseNode::Function:
+            functionNode();  // calls this visit function recursively
+            break;
+        case ParseNode::Return:
+            returnNode();
+            return ; //
+        case ParseNode::Expression:
+            continue;
+        case ParseNode::Constant:
+        case ParseNode::BinaryOp:
+        case ParseNode::UnaryOp:
+            expression();
+            break;
+        default:
+            _lexer->errorStream() << "Unhandled ParseNode kind, sould never end up here. its a bug" << endl;
+            abort();
+        }
+    } while (next());
+}
+
+void IrBuilder::functionNode()
+{
+    // name straight from the interner, no string copy
+    auto name = _ast->token(_cur).symbol();
+    IrFunction fn;
+    fn.name = _lexer->interner().str(name);
+    fn.len = static_cast<uint32_t>(_lexer->interner().len(name));
+    fn.vregs = 0;
+    fn.blocks.push_back(IrBlock{ 0, 0 });
+    _ir->functions().push_back(fn);
+    _fn = &_ir->functions().back();
+    _block = 0;
+
+    next();
+    visit(); // recurse
+    finishFunction();
+}
+
+void IrBuilder::returnNode()
+{
+    next();
+    visit();
+    append(IrInst::Ret, Void, popValue(), none());
+}
+
+void IrBuilder::expression()
+{
+    // post order on an explicit stack, each operator takes its operands
+    // from _values and leaves its result there. stage counts the
+    // operands already done
+    vector<pair<FlatAst::NodeIdx, int> > stack;
+    stack.push_back(make_pair(_cur, 0));
+    while (!stack.empty()) {
+        auto n = stack.back().first;
+        int stage = stack.back().second++;
+        auto kind = _ast->kind(n);
+
+        if (kind == ParseNode::Constant) {
+            constantInt(n);
+            stack.pop_back();
+        } else if (stage == 0) {
+            stack.push_back(make_pair(_ast->left(n), 0));
+        } else if (kind == ParseNode::BinaryOp && stage == 1) {
+            // && and || skip the right side when left decides, the
+            // result is set to what left decided before the branch
+            auto type = _ast->token(n).type;
+            if (type == LexToken::AndAnd || type == LexToken::OrOr) {
+                IrValue a = popValue();
+                Logic l = { _fn->vregs++, 0 };
+                append(IrInst::Copy, I32, imm(type == LexToken::OrOr), none()).dst = l.result;
+                uint32_t right = newBlock();
+                l.end = newBlock();
+                IrInst &br = append(IrInst::Br, Void, a, none());
+                br.target[0] = type == LexToken::AndAnd ? right : l.end;
+                br.target[1] = type == LexToken::AndAnd ? l.end : right;
+                _logic.push_back(l);
+                startBlock(right);
+            }
+            stack.push_back(make_pair(_ast->right(n), 0));
+        } else {
+            if (kind == ParseNode::UnaryOp)
+                unaryOp(n);
+            else
+                binaryOp(n);
+            stack.pop_back();
+        }
+    }
+}
+
+void IrBuilder::constantInt(FlatAst::NodeIdx n)
+{
+    LexToken tok = _ast->token(n);
+    switch (tok.type) {
+    case LexToken::IntLitteral:
+    case LexToken::OctalLitteral:
+    case LexToken::BinaryLitteral:
+    case LexToken::HexLitteral:
+        // the lexer has decoded and range checked it
+        _values.push_back(imm(static_cast<int32_t>(tok.intValue())));
+        break;
+    default:
+        _lexer->errorStream() << "Error ParseNode LexToken->type not handled\n";
+        _values.push_back(imm(0));
+        _failed = true;
+    }
+}
+
+void IrBuilder::unaryOp(FlatAst::NodeIdx n)
+{
+    LexToken tok = _ast->token(n);
+    IrValue a = popValue();
+    switch (tok.type) {
+    case LexToken::Plus: _values.push_back(a); break;
+    case LexToken::Minus: _values.push_back(emit(IrInst::Neg, a)); break;
+    case LexToken::Tilde: _values.push_back(emit(IrInst::Not, a)); break;
+    case LexToken::Exclamation: _values.push_back(emit(IrInst::Eq, a, imm(0))); break;
+    default:
+        _lexer->errorStream() << "Error unary operator " << tok.type_to_cstr() << " not handled\n";
+        _values.push_back(a);
+        _failed = true;
+    }
+}
+
+void IrBuilder::binaryOp(FlatAst::NodeIdx n)
+{
+    LexToken tok = _ast->token(n);
+
+    if (tok.type == LexToken::AndAnd || tok.type == LexToken::OrOr) {
+        // right side decides, then on to the block both paths end in
+        Logic l = _logic.back();
+        _logic.pop_back();
+        append(IrInst::Ne, I32, popValue(), imm(0)).dst = l.result;
+        append(IrInst::Jmp, Void, none(), none()).target[0] = l.end;
+        startBlock(l.end);
+        _values.push_back(IrValue::makeVReg(l.result));
+        return;
+    }
+
+    IrInst::Op op;
+    switch (tok.type) {
+    case LexToken::Plus: op = IrInst::Add; break;
+    case LexToken::Minus: op = IrInst::Sub; break;
+    case LexToken::Star: op = IrInst::Mul; break;
+    case LexToken::Slash: op = IrInst::Div; break;
+    case LexToken::Percent: op = IrInst::Mod; break;
+    case LexToken::Ampersand: op = IrInst::And; break;
+    case LexToken::Pipe: op = IrInst::Or; break;
+    case LexToken::Caret: op = IrInst::Xor; break;
+    case LexToken::ShiftLeft: op = IrInst::Shl; break;
+    case LexToken::ShiftRight: op = IrInst::Sar; break;
+    case LexToken::EqualEqual: op = IrInst::Eq; break;
+    case LexToken::NotEqual: op = IrInst::Ne; break;
+    case LexToken::Less: op = IrInst::Lt; break;
+    case LexToken::LessEqual: op = IrInst::Le; break;
+    case LexToken::Greater: op = IrInst::Gt; break;
+    case LexToken::GreaterEqual: op = IrInst::Ge; break;
+    default:
+        _lexer->errorStream() << "Error binary operator " << tok.type_to_cstr() << " not handled\n";
+        _values.pop_back(); // right, left stays as the result
+        _failed = true;
+        return;
+    }
+    IrValue b = popValue(), a = popValue();
+    _values.push_back(emit(op, a, b));
+}
+
+uint32_t IrBuilder::newBlock()
+{
+    _fn->blocks.push_back(IrBlock{ 0, 0 });
+    return static_cast<uint32_t>(_fn->blocks.size() - 1);
+}
+
+void IrBuilder::startBlock(uint32_t b)
+{
+    uint32_t pos = static_cast<uint32_t>(_fn->insts.size());
+    _fn->blocks[_block].end = pos;
+    _fn->blocks[b].begin = pos;
+    _block = b;
+}
+
+void IrBuilder::finishFunction()
+{
+    // falls off the end, return 0 like main does
+    if (!terminated())
+        append(IrInst::Ret, Void, imm(0), none());
+    _fn->blocks[_block].end = static_cast<uint32_t>(_fn->insts.size());
+
+    // blocks got their numbers when first jumped to, give them their
+    // place in the instruction array instead
+    vector<IrBlock> &blocks = _fn->blocks;
+    vector<uint32_t> order(blocks.size()), nr(blocks.size());
+    for (uint32_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    sort(order.begin(), order.end(), [&](uint32_t x, uint32_t y) {
+        return blocks[x].begin < blocks[y].begin;
+    });
+    vector<IrBlock> sorted(blocks.size());
+    for (uint32_t i = 0; i < order.size(); ++i) {
+        nr[order[i]] = i;
+        sorted[i] = blocks[order[i]];
+    }
+    blocks.swap(sorted);
+
+    for (IrInst &inst : _fn->insts) {
+        if (inst.op == IrInst::Jmp || inst.op == IrInst::Br)
+            inst.target[0] = nr[inst.target[0]];
+        if (inst.op == IrInst::Br)
+            inst.target[1] = nr[inst.target[1]];
+    }
+}
+
+bool IrBuilder::terminated() const
+{
+    return _fn->insts.size() > _fn->blocks[_block].begin && _fn->insts.back().isTerminator();
+}
+
+// code after a ret or jmp goes into a block of its own
+IrInst &IrBuilder::append(IrInst::Op op, IrType type, IrValue a, IrValue b)
+{
+    if (terminated())
+        startBlock(newBlock());
+    IrInst inst = { op, type, 0, a, b, { 0, 0 } };
+    _fn->insts.push_back(inst);
+    return _fn->insts.back();
+}
+
+// a value op into a new register
+IrValue IrBuilder::emit(IrInst::Op op, IrValue a, IrValue b)
+{
+    IrInst &inst = append(op, I32, a, b);
+    inst.dst = _fn->vregs++;
+    return IrValue::makeVReg(inst.dst);
+}
+
+IrValue IrBuilder::popValue()
+{
+    IrValue v = _values.back();
+    _values.pop_back();
+    return v;
+}
+
+bool IrBuilder::next()
+{
+    return _cur != FlatAst::NoNode &&
+           (_cur = _ast->operat(_cur)) != FlatAst::NoNode;
+}
@@ -0,0 +1,56 @@
+#ifndef IRBUILDER_H
+#define IRBUILDER_H
+
+#include <vector>
+
+#include "parser.h"
+#include "ir.h"
+
+namespace Cmp {
+
+// lowers the FlatAst to IR, a function at a time. Expression temporaries
+// get a new register each, constants stay immediates in the operands
+class IrBuilder
+{
+    Lexer *_lexer;
+    const FlatAst *_ast;
+    FlatAst::NodeIdx _cur; // node we are visiting
+    IrProgram *_ir;
+    IrFunction *_fn;       // being built
+    uint32_t _block;       // being filled
+    bool _failed;
+    std::vector<IrValue> _values; // operands not used yet
+    // open && and ||, register for the result and the block after them
+    struct Logic {
+        uint32_t result, end;
+    };
+    std::vector<Logic> _logic;
+public:
+    explicit IrBuilder(Lexer *lex);
+
+    // false if something in the tree couldn't be lowered
+    bool build(const FlatAst &ast, IrProgram &ir);
+
+private:
+    void visit();
+    void functionNode();
+    void returnNode();
+    void expression();       // tree at _cur, result left in _values
+    void constantInt(FlatAst::NodeIdx n);
+    void unaryOp(FlatAst::NodeIdx n);
+    void binaryOp(FlatAst::NodeIdx n);
+
+    uint32_t newBlock();
+    void startBlock(uint32_t b);
+    void finishFunction();
+    bool terminated() const;
+    IrInst &append(IrInst::Op op, IrType type, IrValue a, IrValue b);
+    IrValue emit(IrInst::Op op, IrValue a, IrValue b = IrValue::makeNone());
+    IrValue popValue();
+
+    bool next();
+};
+
+} // namespace Cmp
+
+#endif // IRBUILDER_H
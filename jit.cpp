@@ -0,0 +1,130 @@
+#include "jit.h"
+#include <cstring>
+#include <csignal>
+#include <csetjmp>
+#include <unistd.h>
+#include <sys/mman.h>
+
+using namespace Cmp;
+using namespace std;
+
+namespace {
+
+// each -j thread runs its own code, the handler jumps back to the
+// run() on the thread that faulted
+thread_local sigjmp_buf *_crashJmp = nullptr;
+
+void crashHandler(int sig)
+{
+    if (_crashJmp)
+        siglongjmp(*_crashJmp, sig);
+    // not ours, default action
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+// once for the process, the handlers stay, they only act while
+// a thread is inside run()
+bool installHandlers()
+{
+    const int crashSignals[] = { SIGFPE, SIGSEGV, SIGBUS, SIGILL };
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = crashHandler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_NODEFER | SA_ONSTACK;
+    for (int sig : crashSignals)
+        sigaction(sig, &sa, nullptr);
+    return true;
+}
+
+// a blown stack must still be able to run the handler
+void setupAltStack()
+{
+    thread_local bool done = false;
+    thread_local char altStack[64 * 1024];
+    if (done)
+        return;
+    stack_t ss;
+    memset(&ss, 0, sizeof(ss));
+    ss.ss_sp = altStack;
+    ss.ss_size = sizeof(altStack);
+    sigaltstack(&ss, nullptr);
+    done = true;
+}
+
+} // namespace
+
+Jit::Jit()
+    : _mem(nullptr)
+    , _size(0)
+{ }
+
+Jit::~Jit()
+{
+    unload();
+}
+
+bool Jit::supported()
+{
+#if defined(__x86_64__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Jit::unload()
+{
+    if (_mem)
+        munmap(_mem, _size);
+    _mem = nullptr;
+    _size = 0;
+}
+
+bool Jit::load(const vector<uint8_t> &code)
+{
+    unload();
+    long page = sysconf(_SC_PAGESIZE);
+    size_t size = (code.size() + static_cast<size_t>(page) - 1) & ~(static_cast<size_t>(page) - 1);
+    if (size == 0)
+        size = static_cast<size_t>(page);
+
+    // never writable and executable at the same time
+    void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return false;
+    memcpy(mem, code.data(), code.size());
+    if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, size);
+        return false;
+    }
+    _mem = mem;
+    _size = size;
+    return true;
+}
+
+bool Jit::run(size_t entry, int &result, int &crashSignal)
+{
+    static bool installed = installHandlers();
+    (void)installed;
+    setupAltStack();
+
+    crashSignal = 0;
+    if (!_mem || entry >= _size)
+        return false;
+
+    sigjmp_buf jmp;
+    bool ok = true;
+    int sig = sigsetjmp(jmp, 1);
+    if (sig == 0) {
+        _crashJmp = &jmp;
+        auto fn = reinterpret_cast<int (*)()>(static_cast<char*>(_mem) + entry);
+        result = fn();
+    } else {
+        crashSignal = sig;
+        ok = false;
+    }
+    _crashJmp = nullptr;
+    return ok;
+}
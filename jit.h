@@ -0,0 +1,40 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <inttypes.h>
+#include <cstddef>
+#include <vector>
+
+namespace Cmp {
+
+// runs code encoded for the host (X86Encoder::Mode64) in this process,
+// the code is copied into an mmap'ed region that is made executable.
+// A crash in the code (ie. divide by zero) is caught and reported,
+// it does not take the compiler down.
+class Jit
+{
+public:
+    explicit Jit();
+    ~Jit();
+
+    // false and errno set if the memory could not be mapped
+    bool load(const std::vector<uint8_t> &code);
+    // calls int fn() at entry, false if it crashed, crashSignal tells why
+    bool run(size_t entry, int &result, int &crashSignal);
+
+    // the host can run what we encode
+    static bool supported();
+
+private:
+    Jit(const Jit &) = delete;
+    Jit &operator=(const Jit &) = delete;
+
+    void unload();
+
+    void *_mem;
+    size_t _size;
+};
+
+} // namespace Cmp
+
+#endif // JIT_H
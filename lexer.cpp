@@ -1,125 +1,276 @@
 ﻿#include "lexer.h"
+#include "simdscan.h"
 #include <cstring>
+#include <cstdlib>
+#include <cerrno>
 #include <cassert>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
 
 using namespace Cmp;
 using namespace std;
 
 
 // --------------------------------------------------------------------
+// static to this file, all of it is built by the compiler, no static init
 
-namespace Cmp {
+namespace {
 
-class Match {
-public:
-    explicit Match(const char* str, LexToken ::Tokens type)
-        : str(str)
-        , len(strlen(str))
-        , type(type)
-    {}
+struct Keyword {
     const char *str;
-    const size_t len;
-    const LexToken::Tokens type;
+    LexToken::Tokens type;
 };
 
+// keyword statements, any order
+constexpr Keyword _kws[] = {
+    { "return", LexToken::KwReturn },
+    { "int", LexToken::KwInt }
+};
 
-class Matches {
-public:
-    Matches(const Match *matches, size_t sz)
-        : m(matches)
-        , sz(sz)
-        , minLen(10000)
-        , maxLen(0)
-    {
-        // previously calculate min max str length
-        for (size_t i = 0; i < sz; ++i) {
-            size_t len = strnlen((matches+i)->str, 1024);
-            if (len < minLen) minLen = len;
-            if (len > maxLen) maxLen = len;
-        }
-    }
+constexpr size_t kwCount = sizeof(_kws) / sizeof(_kws[0]);
+constexpr uint8_t NoKw = 0xFF;
+constexpr unsigned kwTableSize = 128; // power of 2
 
-    // set cnt to how many matches there are for str, when we cnt == 1 match should be the correct one
-    const Match* matchCnt(const char* str, size_t strlen, uint &cnt) const
-    {
-        const Match *match = nullptr;
-        for (size_t i = 0; i < sz; ++i) {
-            if (m[i].len >= strlen && (strncmp(str, m[i].str, strlen) == 0)) {
-                match = &m[i];
-                ++cnt;
-            }
-        }
-        if (cnt > 1)
-            return nullptr;
-        return match;
-    }
-/*
-    // match char by char, broken thought....
-    const Match *match(const char c, size_t pos) const
-    {
-        if (pos > maxLen)
-            return nullptr;
-        for (size_t i = 0; i < sz; ++i) {
-            if (m[i].len >= pos && m[i].str[pos] == c)
-                return &m[i];
-        }
-        return nullptr;
-    }
-*/
-    const Match *m;
-    const size_t sz;
-    size_t minLen, maxLen; // minimu len and maximum length of match
+constexpr size_t cstrLen(const char *s)
+{
+    return *s == 0 ? 0 : 1 + cstrLen(s + 1);
+}
+
+// perfect for the full C99 keyword set below (checked), so keywords can
+// be added to _kws without touching it. In 64 slots it wasn't, union and
+// _Imaginary collided, and no coefficients of this form fix that.
+// all keywords are at least 2 chars
+constexpr unsigned kwHash(const char *s, size_t len)
+{
+    return (static_cast<unsigned>(s[0]) * 15u + static_cast<unsigned>(s[1]) * 14u
+            + static_cast<unsigned>(s[len - 1]) + static_cast<unsigned>(len))
+           & (kwTableSize - 1);
+}
+
+constexpr const char *_c99Kws[] = {
+    "auto", "break", "case", "char", "const", "continue", "default", "do",
+    "double", "else", "enum", "extern", "float", "for", "goto", "if",
+    "inline", "int", "long", "register", "restrict", "return", "short",
+    "signed", "sizeof", "static", "struct", "switch", "typedef", "union",
+    "unsigned", "void", "volatile", "while", "_Bool", "_Complex", "_Imaginary"
+};
+constexpr size_t c99KwCount = sizeof(_c99Kws) / sizeof(_c99Kws[0]);
+
+constexpr unsigned c99KwHashAt(size_t i)
+{
+    return kwHash(_c99Kws[i], cstrLen(_c99Kws[i]));
+}
+
+constexpr bool c99KwCollides(size_t i, size_t j)
+{
+    return j == c99KwCount ? false :
+           c99KwHashAt(i) == c99KwHashAt(j) || c99KwCollides(i, j + 1);
+}
+
+constexpr bool c99KwPerfect(size_t i = 0)
+{
+    return i == c99KwCount ? true : !c99KwCollides(i, i + 1) && c99KwPerfect(i + 1);
+}
+
+constexpr unsigned kwHashAt(size_t i)
+{
+    return kwHash(_kws[i].str, cstrLen(_kws[i].str));
+}
+
+constexpr uint8_t kwSlotFor(unsigned h, size_t i = 0)
+{
+    return i == kwCount ? NoKw :
+           kwHashAt(i) == h ? static_cast<uint8_t>(i) : kwSlotFor(h, i + 1);
+}
+
+constexpr bool kwCollides(size_t i, size_t j)
+{
+    return j == kwCount ? false :
+           kwHashAt(i) == kwHashAt(j) || kwCollides(i, j + 1);
+}
+
+constexpr bool kwPerfect(size_t i = 0)
+{
+    return i == kwCount ? true : !kwCollides(i, i + 1) && kwPerfect(i + 1);
+}
+
+constexpr size_t kwMinLen(size_t i = 0)
+{
+    return i == kwCount ? ~size_t(0) :
+           cstrLen(_kws[i].str) < kwMinLen(i + 1) ? cstrLen(_kws[i].str) : kwMinLen(i + 1);
+}
+
+constexpr size_t kwMaxLen(size_t i = 0)
+{
+    return i == kwCount ? 0 :
+           cstrLen(_kws[i].str) > kwMaxLen(i + 1) ? cstrLen(_kws[i].str) : kwMaxLen(i + 1);
+}
+
+static_assert(kwCount < NoKw, "too many keywords for slot table");
+static_assert(kwPerfect(), "keyword hash collision, tweak kwHash");
+static_assert(c99KwCount == 37 && c99KwPerfect(), "C99 keyword hash collision, tweak kwHash");
+constexpr size_t kwShortest = kwMinLen(), kwLongest = kwMaxLen();
+
+static_assert(kwShortest >= 2, "kwHash needs keywords of at least 2 chars");
+
+#define CMP_ROW16(f, b) \
+    f(b+0), f(b+1), f(b+2), f(b+3), f(b+4), f(b+5), f(b+6), f(b+7), \
+    f(b+8), f(b+9), f(b+10), f(b+11), f(b+12), f(b+13), f(b+14), f(b+15)
+#define CMP_TABLE256(f) \
+    CMP_ROW16(f, 0), CMP_ROW16(f, 16), CMP_ROW16(f, 32), CMP_ROW16(f, 48), \
+    CMP_ROW16(f, 64), CMP_ROW16(f, 80), CMP_ROW16(f, 96), CMP_ROW16(f, 112), \
+    CMP_ROW16(f, 128), CMP_ROW16(f, 144), CMP_ROW16(f, 160), CMP_ROW16(f, 176), \
+    CMP_ROW16(f, 192), CMP_ROW16(f, 208), CMP_ROW16(f, 224), CMP_ROW16(f, 240)
+
+constexpr uint8_t _kwSlots[kwTableSize] = {
+    CMP_ROW16(kwSlotFor, 0), CMP_ROW16(kwSlotFor, 16),
+    CMP_ROW16(kwSlotFor, 32), CMP_ROW16(kwSlotFor, 48),
+    CMP_ROW16(kwSlotFor, 64), CMP_ROW16(kwSlotFor, 80),
+    CMP_ROW16(kwSlotFor, 96), CMP_ROW16(kwSlotFor, 112)
 };
+static_assert(kwTableSize == 8 * 16, "_kwSlots needs a CMP_ROW16 per 16 slots");
 
-} // namespace Cmp
+// single char delimiters and operators, indexed by the char,
+// '/' is not here, it goes through comment()
+constexpr uint8_t delimKindOf(int c)
+{
+    return c == '{' ? LexToken::OpenBrace :
+           c == '}' ? LexToken::CloseBrace :
+           c == '[' ? LexToken::OpenBracket :
+           c == ']' ? LexToken::CloseBracket :
+           c == '(' ? LexToken::OpenParen :
+           c == ')' ? LexToken::CloseParen :
+           c == ';' ? LexToken::SemiColon :
+           c == '+' ? LexToken::Plus :
+           c == '-' ? LexToken::Minus :
+           c == '*' ? LexToken::Star :
+           c == '%' ? LexToken::Percent :
+           c == '~' ? LexToken::Tilde :
+           c == '!' ? LexToken::Exclamation :
+           c == '&' ? LexToken::Ampersand :
+           c == '|' ? LexToken::Pipe :
+           c == '^' ? LexToken::Caret :
+           c == '<' ? LexToken::Less :
+           c == '>' ? LexToken::Greater :
+           c == '=' ? LexToken::Assign : LexToken::Undefined;
+}
 
+constexpr uint8_t _delimKind[256] = { CMP_TABLE256(delimKindOf) };
 
+} // namespace
 
-// static to this file
-// keyword statements, must be longest str first descending order
-static const Match _kws[] = {
-    Match("return", LexToken::KwReturn),
-    Match("int", LexToken::KwInt)
+
+// character classes for the first byte of a token, tokenize() dispatches on
+// these so each position only runs the state machine that can match it
+enum CharClass : uint8_t {
+    CcOther, CcEnd, CcSpace, CcNewLine, CcBackslash, CcSlash,
+    CcDelim, CcQuote, CcDigit, CcIdent
 };
-static const Match _delims[] = {
-    Match("{", LexToken::OpenBrace), Match("}", LexToken::CloseBrace),
-    Match("[", LexToken::OpenBracket), Match("]", LexToken::CloseBracket),
-    Match("(", LexToken::OpenParen), Match(")", LexToken::CloseParen),
-    Match(";", LexToken::SemiColon)
+
+// character kinds used as input to the number state machine
+enum NumKind : uint8_t {
+    NkEnd, NkZero, NkOne, NkOct, NkDec, NkB, NkX, NkHex, NkDot, NkAlpha,
+    NkCount
 };
 
-static Matches delims (&_delims[0], sizeof(_delims) / sizeof (_delims[0]));
-static Matches kws (&_kws[0], sizeof (_kws) / sizeof (_kws[0]));
+static constexpr bool isIdentStart(int c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static constexpr uint8_t charClassOf(int c)
+{
+    return c == 0 ? CcEnd :
+           c == '\n' ? CcNewLine :
+           (c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f') ? CcSpace :
+           c == '\\' ? CcBackslash :
+           c == '/' ? CcSlash :
+           delimKindOf(c) != LexToken::Undefined ? CcDelim :
+           (c == '\'' || c == '"') ? CcQuote :
+           (c >= '0' && c <= '9') ? CcDigit :
+           isIdentStart(c) ? CcIdent : CcOther;
+}
+
+static constexpr uint8_t numKindOf(int c)
+{
+    return c == '0' ? NkZero :
+           c == '1' ? NkOne :
+           (c >= '2' && c <= '7') ? NkOct :
+           (c == '8' || c == '9') ? NkDec :
+           (c == 'b' || c == 'B') ? NkB :
+           (c == 'x' || c == 'X') ? NkX :
+           ((c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F')) ? NkHex :
+           c == '.' ? NkDot :
+           isIdentStart(c) ? NkAlpha : NkEnd;
+}
+
+static constexpr uint8_t _charClass[256] = { CMP_TABLE256(charClassOf) };
+static constexpr uint8_t _numKind[256] = { CMP_TABLE256(numKindOf) };
+
+static inline uint8_t charClass(char c) { return _charClass[static_cast<uint8_t>(c)]; }
+static inline uint8_t numKind(char c) { return _numKind[static_cast<uint8_t>(c)]; }
+static inline unsigned digitValue(char c)
+{
+    return c <= '9' ? static_cast<unsigned>(c - '0')
+                    : static_cast<unsigned>((c | 0x20) - 'a' + 10);
+}
+static inline bool isIdentChar(char c)
+{
+    uint8_t cls = charClass(c);
+    return cls == CcIdent || cls == CcDigit;
+}
+
+// number literals, one row per state, one column per NumKind
+// 0b101 binary, 0x1F hex, 017 octal, 12 decimal, 1.5 float
+enum NumState : uint8_t {
+    NsStart, NsZero, NsOct, NsDec, NsHexPre, NsHex, NsBinPre, NsBin, NsFloat, NsErr
+};
+
+static const uint8_t _numStates[][NkCount] = {
+//   End      Zero     One      Oct      Dec      B         X         Hex      Dot      Alpha
+    {NsErr,   NsZero,  NsDec,   NsDec,   NsDec,   NsErr,    NsErr,    NsErr,   NsErr,   NsErr}, // NsStart
+    {NsZero,  NsOct,   NsOct,   NsOct,   NsErr,   NsBinPre, NsHexPre, NsErr,   NsFloat, NsErr}, // NsZero
+    {NsOct,   NsOct,   NsOct,   NsOct,   NsErr,   NsErr,    NsErr,    NsErr,   NsFloat, NsErr}, // NsOct
+    {NsDec,   NsDec,   NsDec,   NsDec,   NsDec,   NsErr,    NsErr,    NsErr,   NsFloat, NsErr}, // NsDec
+    {NsErr,   NsHex,   NsHex,   NsHex,   NsHex,   NsHex,    NsErr,    NsHex,   NsErr,   NsErr}, // NsHexPre
+    {NsHex,   NsHex,   NsHex,   NsHex,   NsHex,   NsHex,    NsErr,    NsHex,   NsErr,   NsErr}, // NsHex
+    {NsErr,   NsBin,   NsBin,   NsErr,   NsErr,   NsErr,    NsErr,    NsErr,   NsErr,   NsErr}, // NsBinPre
+    {NsBin,   NsBin,   NsBin,   NsErr,   NsErr,   NsErr,    NsErr,    NsErr,   NsErr,   NsErr}, // NsBin
+    {NsFloat, NsFloat, NsFloat, NsFloat, NsFloat, NsErr,    NsErr,    NsErr,   NsErr,   NsErr}, // NsFloat
+    {NsErr,   NsErr,   NsErr,   NsErr,   NsErr,   NsErr,    NsErr,    NsErr,   NsErr,   NsErr}, // NsErr
+};
+
+// what a state accepts as when the number ends there
+static const LexToken::Tokens _numAccepts[] = {
+    LexToken::Undefined, LexToken::OctalLitteral, LexToken::OctalLitteral,
+    LexToken::IntLitteral, LexToken::Undefined, LexToken::HexLitteral,
+    LexToken::Undefined, LexToken::BinaryLitteral, LexToken::FloatLitteral,
+    LexToken::Undefined
+};
 
 
 // -------------------------------------------------------------------------
 
-LexToken::LexToken(LexToken::Tokens type, const char *pos, size_t len)
+LexToken::LexToken(LexToken::Tokens type, const char *pos, size_t len, uint64_t value)
     : type(type)
     , pos(pos)
     , len(len)
+    , value(value)
 { }
 
 LexToken::LexToken()
     : type(Undefined)
     , pos(nullptr)
     , len(0)
+    , value(0)
 { }
 
-LexToken::LexToken(const LexToken &other)
-    : type(other.type)
-    , pos(other.pos)
-    , len(other.len)
-{ }
-
-LexToken &LexToken::operator=(const LexToken &other)
+double LexToken::floatValue() const
 {
-    *const_cast<Tokens*>(&type) = other.type;
-    *const_cast<char**>(&pos) = *const_cast<char**>(&other.pos);
-    *const_cast<size_t*>(&len) = other.len;
-    return *this;
+    double d;
+    memcpy(&d, &value, sizeof(d));
+    return d;
 }
 
 const char* LexToken::type_to_cstr() const
@@ -135,6 +286,27 @@ const char* LexToken::type_to_cstr() const
     case OpenBracket: return "OpenBracket";
     case CloseBracket: return "CloseBracket";
     case SemiColon: return "SemiColon";
+    case Plus: return "Plus";
+    case Minus: return "Minus";
+    case Star: return "Star";
+    case Slash: return "Slash";
+    case Percent: return "Percent";
+    case Tilde: return "Tilde";
+    case Exclamation: return "Exclamation";
+    case Ampersand: return "Ampersand";
+    case Pipe: return "Pipe";
+    case Caret: return "Caret";
+    case Less: return "Less";
+    case Greater: return "Greater";
+    case Assign: return "Assign";
+    case ShiftLeft: return "ShiftLeft";
+    case ShiftRight: return "ShiftRight";
+    case LessEqual: return "LessEqual";
+    case GreaterEqual: return "GreaterEqual";
+    case EqualEqual: return "EqualEqual";
+    case NotEqual: return "NotEqual";
+    case AndAnd: return "AndAnd";
+    case OrOr: return "OrOr";
     case KwInt: return "KwInt";
     case KwReturn: return "KwReturn";
     case Identifier: return "Identifier";
@@ -149,12 +321,104 @@ const char* LexToken::type_to_cstr() const
     return nullptr;
 }
 
+// -----------------------------------------------------------------------------------------
+
+const uint16_t TokenList::LongLen;
+const Lexer::FileId Lexer::NoFile;
+
+TokenList::TokenList(const char *base)
+    : _base(base)
+{ }
+
+void TokenList::clear()
+{
+    _offsets.clear();
+    _lens.clear();
+    _kinds.clear();
+    _longLens.clear();
+    _values.clear();
+    _valueBits.clear();
+    _valuesBefore.clear();
+}
+
+void TokenList::reserve(size_t n)
+{
+    _offsets.reserve(n);
+    _lens.reserve(n);
+    _kinds.reserve(n);
+    _valueBits.reserve((n + 63) / 64);
+    _valuesBefore.reserve((n + 63) / 64);
+}
+
+void TokenList::shrink_to_fit()
+{
+    _offsets.shrink_to_fit();
+    _lens.shrink_to_fit();
+    _kinds.shrink_to_fit();
+    _longLens.shrink_to_fit();
+    _values.shrink_to_fit();
+    _valueBits.shrink_to_fit();
+    _valuesBefore.shrink_to_fit();
+}
+
+void TokenList::push_back(const LexToken &tok)
+{
+    assert(tok.pos >= _base && static_cast<size_t>(tok.pos - _base) <= UINT32_MAX);
+    if (tok.len >= LongLen) {
+        _longLens.push_back(make_pair(static_cast<uint32_t>(size()),
+                                      static_cast<uint32_t>(tok.len)));
+        _lens.push_back(LongLen);
+    } else
+        _lens.push_back(static_cast<uint16_t>(tok.len));
+    size_t i = size();
+    if (i % 64 == 0) {
+        _valueBits.push_back(0);
+        _valuesBefore.push_back(static_cast<uint32_t>(_values.size()));
+    }
+    if (tok.hasValue()) {
+        _valueBits.back() |= uint64_t(1) << (i % 64);
+        _values.push_back(tok.value);
+    }
+    _offsets.push_back(static_cast<uint32_t>(tok.pos - _base));
+    _kinds.push_back(static_cast<uint8_t>(tok.type));
+}
+
+size_t TokenList::longLen(size_t i) const
+{
+    auto it = lower_bound(_longLens.begin(), _longLens.end(),
+                          make_pair(static_cast<uint32_t>(i), uint32_t(0)));
+    assert(it != _longLens.end() && it->first == i);
+    return it->second;
+}
+
+uint64_t TokenList::value(size_t i) const
+{
+    uint64_t bits = _valueBits[i / 64], bit = uint64_t(1) << (i % 64);
+    if (!(bits & bit))
+        return 0;
+    return _values[_valuesBefore[i / 64] + static_cast<size_t>(__builtin_popcountll(bits & (bit - 1)))];
+}
+
+size_t TokenList::memoryUsage() const
+{
+    return _offsets.capacity() * sizeof(uint32_t) + _lens.capacity() * sizeof(uint16_t)
+         + _kinds.capacity() * sizeof(uint8_t)
+         + _longLens.capacity() * sizeof(_longLens[0])
+         + _values.capacity() * sizeof(_values[0])
+         + _valueBits.capacity() * sizeof(_valueBits[0])
+         + _valuesBefore.capacity() * sizeof(_valuesBefore[0]);
+}
+
 // -----------------------------------------------------------------------------------------
 Lexer::Lexer(bool breakOnSyntaxError)
     : _start(nullptr)
     , _curPos(nullptr)
-    , _acceptedPos(nullptr)
+    , _file(nullptr)
     , _breakOnSyntaxError(breakOnSyntaxError)
+    , _failed(false)
+    , _stopped(false)
+    , _rejected(nullptr)
+    , _err(&cerr)
 { }
 
 Lexer::~Lexer()
@@ -162,80 +426,146 @@ Lexer::~Lexer()
 
 bool Lexer::tokenize(const char *srcStr[], const char *filename)
 {
-    auto fileIt = files.find(filename);
-    if (fileIt != files.end())
-        files.erase(fileIt);
-
-    tokens.clear();
-
-    _start = _curPos = _acceptedPos = *srcStr;
+    // tokens go straight into the files own store, no copy afterwards
+    beginFile(*srcStr, filename);
+
+    for (LexToken tok = lexToken(); tok.isValid(); tok = lexToken()) {
+        if (tok.type == LexToken::Comment || tok.type == LexToken::NewLine) {
+            _file->trivia.push_back(tok);
+            _file->triviaNext.push_back(static_cast<uint32_t>(_file->tokens.size()));
+        } else
+            _file->tokens.push_back(tok);
+    }
 
-    const char *lastIterPos = nullptr;
-    bool res = true;
+    endFile();
+    _file->tokens.shrink_to_fit();
+    _file->trivia.shrink_to_fit();
 
-    for (;*_curPos != 0;) {
-        lastIterPos = _acceptedPos;
+    return !_failed;
+}
 
-        // first newline check must be done before whitespace
-        LexToken tok = newLine();
-        if (tryAccept(tok))
-            continue;
+void Lexer::beginStream(const char *srcStr[], const char *filename)
+{
+    // the file gets line starts but no token store
+    beginFile(*srcStr, filename);
+}
 
-        space(); // eat up all whitespace
+LexToken Lexer::streamNext()
+{
+    for (LexToken tok = lexToken(); tok.isValid(); tok = lexToken()) {
+        if (tok.type != LexToken::Comment && tok.type != LexToken::NewLine)
+            return tok;
+    }
 
-        tok = comment();
-        if (tryAccept(tok))
-            continue; // might have newlines and spaces after it
+    endFile();
+    return LexToken();
+}
 
-        tok = delimiter();
-        if (tryAccept(tok))
-            continue;
+void Lexer::beginFile(const char *src, const char *filename)
+{
+    auto idIt = _fileIds.find(filename);
+    if (idIt == _fileIds.end()) {
+        idIt = _fileIds.insert(make_pair(string(filename), static_cast<FileId>(_files.size()))).first;
+        _files.push_back(File());
+    }
+    _file = &_files[idIt->second];
+    _file->name = filename;
+
+    _start = _curPos = src;
+    _failed = _stopped = false;
+    _file->start = _file->end = _start;
+    _file->failed = false;
+    _file->tokens.clear();
+    _file->tokens.setBase(_start);
+    _file->trivia.clear();
+    _file->trivia.setBase(_start);
+    _file->triviaNext.clear();
+    _file->lineStarts.clear();
+    _file->lineStarts.push_back(0);
+}
 
-        //tok = keyWord();
-        //if (tryAccept(tok))
-        //    continue;
+void Lexer::endFile()
+{
+    // find the end for fileAt()
+    while (*_curPos != 0)
+        nextPos();
+    _file->end = _curPos;
+    _file->failed = _failed;
+    _stopped = true;
+}
 
-        tok = stringLitteral();
-        if (tryAccept(tok))
-            continue;
+LexToken Lexer::lexToken()
+{
+    // dispatch on the first byte, only the state machine for that
+    // class of token runs, there is no backtracking between classes
+    for (char c = *_curPos; c != 0 && !_stopped; c = *_curPos) {
+        LexToken tok;
+        switch (charClass(c)) {
+        case CcSpace: case CcBackslash:
+            if (space())
+                continue;
+            break;
+        case CcNewLine:
+            tok = newLine(); break;
+        case CcSlash:
+            tok = comment(); break;
+        case CcDelim:
+            tok = delimiter(); break;
+        case CcQuote:
+            tok = stringLitteral(); break;
+        case CcDigit:
+            tok = intLitteral(); break;
+        case CcIdent:
+            tok = identifierOrKeword(); break;
+        default: ; // not a valid start of token
+        }
 
-        tok = intLitteral();
-        if (tryAccept(tok))
-            continue;
+        if (tok.isValid() && static_cast<size_t>(tok.pos - _start) > UINT32_MAX) {
+            errorStream() << "File " << _file->name << " is too large, max 4GB" << endl;
+            _failed = _stopped = true;
+            break;
+        }
 
-        tok = identifierOrKeword();
-        if (tryAccept(tok))
-            continue;
+        if (tok.isValid()) {
+            _curPos = tok.pos + tok.len;
+            return tok;
+        }
 
-        if (lastIterPos >= _acceptedPos) {
-            res = false;
-            syntaxError(curPos()); // print err msg
-            if (!_breakOnSyntaxError)
-                for(char c = *nextPos(); c != 0 && c != '\n'; c = *nextPos())
-                    ;
-            else
-                break; // we can't do this anymore
+        // the one place a bad token is reported, with the reason if
+        // the scanner gave one
+        _failed = true;
+        syntaxError(curPos(), _rejected ? _rejected : "Syntax Error"); // print err msg
+        _rejected = nullptr;
+        if (_breakOnSyntaxError) {
+            _stopped = true;
+            break; // we can't do this anymore
         }
-    }
 
-    // store this file in our filemap
-    files[filename] = tokens;
+        for (c = *_curPos; c != 0 && c != '\n'; c = *nextPos())
+            ;
+    }
 
-    return res;
+    return LexToken();
 }
 
-string Lexer::to_string(const char *filename)
+string Lexer::to_string(const char *filename) const
 {
     stringstream ret;
-    if (files.find(filename) == files.end()) {
+    const File *f = file(fileId(filename));
+    if (!f) {
         ret << "Could not find " << filename << " among tokinized files" << endl;
 
-    } else if(files[filename].size()) {
-        T_Tokens toks = files[filename];
-        const char *linestart = toks[0].pos;
+    } else if(f->tokens.size() || f->trivia.size()) {
+        // merge significant tokens and trivia back into source order
+        const T_Tokens &toks = f->tokens, &trivia = f->trivia;
+        const char *linestart = toks.empty() ? trivia.pos(0)
+                              : trivia.empty() ? toks.pos(0) : min(toks.pos(0), trivia.pos(0));
         ret << 1 << ":";
         uint prevLinePos = 0;
-        for (auto tok : toks) {
+        for (size_t i = 0, t = 0; i < toks.size() || t < trivia.size();) {
+            const LexToken tok = (t < trivia.size() &&
+                                  (i == toks.size() || trivia.pos(t) < toks.pos(i)))
+                                    ? trivia.at(t++) : toks.at(i++);
             if (tok.type == LexToken::NewLine) {
                 ret << tok.type_to_cstr() << endl << lineAtPos(tok.pos) +1 << ":";
                 linestart = tok.pos +1;
@@ -257,31 +587,35 @@ string Lexer::to_string(const char *filename)
     return ret.str();
 }
 
-uint Lexer::lineForToken(LexToken &tok)
+uint Lexer::lineForToken(const LexToken &tok) const
 {
     return lineAtPos(tok.pos);
 }
 
-void Lexer::syntaxError(const char* errPos)
+pair<size_t, size_t> Lexer::File::triviaBefore(size_t tokIdx) const
 {
-    const char *start = errPos,
-               *linePos = _start;
-    // find out linenr and pos in line
-    uint line = 0, pos = 0;
-    const char *cp = _start;
-    for (; *cp != 0 && cp < start; ++cp) {
-        if (*cp == '\n') {
-            ++line;
-            linePos = cp+1;
-        }
-    }
+    auto first = lower_bound(triviaNext.begin(), triviaNext.end(), tokIdx),
+         last = upper_bound(first, triviaNext.end(), tokIdx);
+    return make_pair(static_cast<size_t>(first - triviaNext.begin()),
+                     static_cast<size_t>(last - triviaNext.begin()));
+}
 
-    // pos in line
-    pos = static_cast<uint>(cp - linePos);
+Lexer::FileId Lexer::fileId(const char *filename) const
+{
+    auto it = _fileIds.find(filename);
+    return it != _fileIds.end() ? it->second : NoFile;
+}
+
+void Lexer::syntaxError(const char* errPos, const char *what) const
+{
+    // find out linenr and pos in line
+    uint line = lineAtPos(errPos),
+         pos = columnAtPos(errPos, line);
+    const char *linePos = errPos - pos;
 
     stringstream str;
 
-    str << "Syntax Error on line: " << line
+    str << what << " on line: " << line
         << " at pos: " << pos << endl;
     // insert the line
     for (const char *lp = linePos; *lp != 0 && *lp != '\n'; ++lp)
@@ -295,204 +629,277 @@ void Lexer::syntaxError(const char* errPos)
 
     str << "^" << endl;
 
-    cerr << str.str();
+    errorStream() << str.str();
 }
 
 
-LexToken Lexer::matchFunc(const Matches *matches)
-{
-    const char *start = curPos();
-
-    size_t len = 1;
-    for (char c = *start; c != 0; c = *nextPos(), ++len) {
-        if (len >= matches->minLen) {
-            if (len > matches->maxLen)
-                break;
-            uint cnt = 0;
-            const Match *m = matches->matchCnt(start, len, cnt);
-            if (cnt < 1)
-                break;
-            else if (cnt == 1)
-                return LexToken(m->type, start, m->len);
-
-        }
-    }
-    return LexToken(); // undef
-}
-
 LexToken Lexer::newLine()
 {
-    const char* start = curPos();
-    if (*start == '\n' && *peek(-1) != '\\')
-        return LexToken(LexToken::NewLine, start, 1);
-    return LexToken();
+    addLine(curPos());
+    return LexToken(LexToken::NewLine, curPos(), 1);
 }
 
-void Lexer::space()
+bool Lexer::space()
 {
-    const char *start = curPos();
-
-    for (const char *cp = start; isspace(*cp);++cp)
-        nextPos();
-
-    if (start < curPos())
-        accept();
+    // blanks and line continuations, newlines are tokens of their own
+    const char *start = curPos(), *cp = start;
+    for (;;) {
+        cp = SimdScan::skipBlanks(cp);
+        if (*cp == '\\' && cp[1] == '\n') {
+            addLine(cp + 1);
+            cp += 2;
+        } else
+            break;
+    }
+    _curPos = cp;
 
-    return;
+    return start < cp;
 }
 
 
 LexToken Lexer::comment()
 {
-    const char *start = curPos();
-    char c = *start;
-    if (c != '/' || (*peek() != '*' && *peek() != '/')) {
-        return LexToken();
+    const char *start = curPos(), *cp = start + 1;
+    if (*cp == '/') {
+        cp = SimdScan::findLineEnd(cp);
+        return LexToken(LexToken::Comment, start, static_cast<size_t>(cp - start));
     }
-    const char close = *nextPos();
-
-    // should be in a comment now
-    while ((c = *nextPos()) != 0) {
-        if (close == '/' && c == '\n')
-            return LexToken(LexToken::Comment, start, static_cast<uint>(curPos() - start));
-        if (c == '*' && close == '*' && '/' == *peek())
-            return LexToken(LexToken::Comment, start, static_cast<uint>(curPos() - start +2));
+    if (*cp != '*')
+        return LexToken(LexToken::Slash, start, 1); // division
+
+    for (cp = SimdScan::findStar(cp + 1); *cp != 0; cp = SimdScan::findStar(cp + 1)) {
+        if (*cp == '\n')
+            addLine(cp);
+        else if (cp[1] == '/')
+            return LexToken(LexToken::Comment, start, static_cast<size_t>(cp + 2 - start));
     }
 
-    return LexToken();
+    return LexToken(); // unterminated
 }
 
 LexToken Lexer::keyWord(const char*start, const char *end)
 {
-    uint cnt = 0;
-    auto m = kws.matchCnt(start, static_cast<size_t>(end - start), cnt);
-    if (cnt == 1 && m->len)
-        return LexToken(m->type, start, static_cast<size_t>(end - start));
+    size_t len = static_cast<size_t>(end - start);
+    if (len < kwShortest || len > kwLongest)
+        return LexToken();
+
+    uint8_t i = _kwSlots[kwHash(start, len)];
+    // keyword strs are NUL terminated, str[len] == 0 means same length
+    if (i != NoKw && memcmp(start, _kws[i].str, len) == 0 && _kws[i].str[len] == 0)
+        return LexToken(_kws[i].type, start, len);
     return LexToken();
 }
 
 LexToken Lexer::delimiter()
 {
-    return matchFunc(&delims);
+    const char *start = curPos();
+    auto type = static_cast<LexToken::Tokens>(_delimKind[static_cast<uint8_t>(*start)]);
+
+    // two char operators, longest match
+    auto two = LexToken::Undefined;
+    switch (*start) {
+    case '<': two = start[1] == '<' ? LexToken::ShiftLeft :
+                    start[1] == '=' ? LexToken::LessEqual : two; break;
+    case '>': two = start[1] == '>' ? LexToken::ShiftRight :
+                    start[1] == '=' ? LexToken::GreaterEqual : two; break;
+    case '=': two = start[1] == '=' ? LexToken::EqualEqual : two; break;
+    case '!': two = start[1] == '=' ? LexToken::NotEqual : two; break;
+    case '&': two = start[1] == '&' ? LexToken::AndAnd : two; break;
+    case '|': two = start[1] == '|' ? LexToken::OrOr : two; break;
+    default: ;
+    }
+    if (two != LexToken::Undefined)
+        return LexToken(two, start, 2);
+
+    return LexToken(type, start, 1);
 }
 
 LexToken Lexer::identifierOrKeword()
 {
     // this is rather trcicky, return0 is not a kwyword, must check entire string before deciding
-    const char* start = curPos();
-    if (!isalpha(*start))
-        return LexToken();
-
-    for (char c = *nextPos(); c != 0; c = *nextPos()) {
-        if (!isalpha(c) && !isdigit(c)) {
-            auto kwTok = keyWord(start, curPos());
-            if (kwTok.isValid())
-                return kwTok;
-            return LexToken(LexToken::Identifier, start, static_cast<uint>(curPos() - start));
-        }
-    }
-    return LexToken();
+    const char *start = curPos(), *cp = start + 1;
+    while (isIdentChar(*cp))
+        ++cp;
+
+    auto kwTok = keyWord(start, cp);
+    if (kwTok.isValid())
+        return kwTok;
+    size_t len = static_cast<size_t>(cp - start);
+    return LexToken(LexToken::Identifier, start, len, _interner.intern(start, len));
 }
 
 LexToken Lexer::intLitteral()
 {
-    const char* start = curPos();
-    char c = *start;
-    LexToken::Tokens type = LexToken::IntLitteral;
-    if (c == 'b')
-        type = LexToken::BinaryLitteral;
-    else if (c == '0') {
-        c = *nextPos();
-        if (c == 'x')
-            type = LexToken::HexLitteral;
-        else if (c < '8')
-            type = LexToken::OctalLitteral;
-    } else if (!isalnum(c))
+    const char *start = curPos(), *cp = start;
+    uint8_t state = NsStart;
+    for (uint8_t kind = numKind(*cp); kind != NkEnd; kind = numKind(*++cp))
+        state = _numStates[state][kind];
+    state = _numStates[state][NkEnd];
+
+    auto type = _numAccepts[state];
+    if (type == LexToken::Undefined)
         return LexToken();
 
-    for(;c != 0 && !isspace(c); c = *nextPos()) {
-        if (!isalnum(c) && c != '.' && c != '_')
-            break;
-
-        switch (type) {
-        case LexToken::BinaryLitteral:
-            if (c > '1') return LexToken();
-            break;
-        case LexToken::OctalLitteral:
-            if (c == '.') type = LexToken::FloatLitteral;
-            else if (c > '7') return LexToken();
-            break;
-        case LexToken::IntLitteral:
-            if (c == '.') type = LexToken::FloatLitteral;
-            else if (c > '9') return LexToken();
-            break;
-        case LexToken::HexLitteral:
-            if (c > '9' && !((c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f')))
-                return LexToken();
-            break;
-        case LexToken::FloatLitteral:
-            if ((c != '.' && c != '_') && (c < '0' || c > '9'))
+    // decode it while the digits are still in cache
+    uint64_t value = 0;
+    if (type == LexToken::FloatLitteral) {
+        char *endp;
+        errno = 0;
+        double d = strtod(start, &endp);
+        if (errno == ERANGE || endp != cp) {
+            _rejected = "Float litteral out of range";
+            return LexToken();
+        }
+        memcpy(&value, &d, sizeof(d));
+    } else {
+        // 0b and 0x prefixes, octal leading 0 does no harm
+        static const unsigned bases[] = { 2, 8, 10, 16 };
+        unsigned base = bases[type - LexToken::BinaryLitteral];
+        const char *dp = start + (base == 2 || base == 16 ? 2 : 0);
+        for (; dp < cp; ++dp) {
+            value = value * base + digitValue(*dp);
+            if (value > UINT32_MAX) {
+                _rejected = "Integer litteral does not fit in 32 bits";
                 return LexToken();
-            break;
-        default: ; // pass
+            }
         }
     }
 
-    if (start < curPos())
-        return LexToken(type, start, static_cast<uint>(curPos() - start));
-    return LexToken();
+    return LexToken(type, start, static_cast<size_t>(cp - start), value);
 }
 
 LexToken Lexer::stringLitteral()
 {
-    const char *start = nextPos();
-    char c = *start, close = *start;
-    LexToken::Tokens type = LexToken::Undefined;
-    if (c == '\'')
-        type = LexToken::SglQteLitteral;
-    else if (c == '"')
-        type = LexToken::DblQteLitteral;
-    else
-        return LexToken();
+    const char *start = curPos(), *cp = start + 1;
+    const char close = *start;
+    LexToken::Tokens type = close == '\'' ? LexToken::SglQteLitteral
+                                          : LexToken::DblQteLitteral;
 
-    for (;c != 0 && c != '\n'; c = *nextPos()) {
-        if (c == close && !('\\' == *peek(-1)))
-            return LexToken(type, start, static_cast<uint>(curPos() - start));
+    for (cp = SimdScan::findQuoteEnd(cp, close); *cp != 0 && *cp != '\n';
+         cp = SimdScan::findQuoteEnd(cp, close))
+    {
+        if (*cp == close)
+            return LexToken(type, start, static_cast<size_t>(cp + 1 - start));
+        if (cp[1] == 0)
+            break;
+        // an escaped newline continues the string on the next line
+        if (cp[1] == '\r' && cp[2] == '\n') {
+            addLine(cp + 2);
+            cp += 3;
+            continue;
+        }
+        if (cp[1] == '\n')
+            addLine(cp + 1);
+        cp += 2; // skip escaped char
     }
 
     return LexToken();
 }
 
+void Lexer::addLine(const char *newLinePos)
+{
+    _file->lineStarts.push_back(static_cast<uint32_t>(newLinePos + 1 - _start));
+}
+
+const Lexer::File *Lexer::fileAt(const char *pos) const
+{
+    // the file being (or last) tokenized is the common case
+    if (_file && pos >= _file->start && pos <= max(_file->end, _curPos))
+        return _file;
+    for (auto &f : _files)
+        if (pos >= f.start && pos <= f.end)
+            return &f;
+    return nullptr;
+}
+
 uint Lexer::lineAtPos(const char* pos) const
 {
-    uint line = 1;
-    for (const char *cp = _start; *cp != 0 && cp != pos; ++cp)
-        if (*cp == '\n')
-            line++;
-    return line;
+    // number of line starts at or before pos
+    const File *f = fileAt(pos);
+    if (!f)
+        return 0;
+    auto it = upper_bound(f->lineStarts.begin(), f->lineStarts.end(),
+                          static_cast<uint32_t>(pos - f->start));
+    return static_cast<uint>(it - f->lineStarts.begin());
+}
+
+uint Lexer::columnAtPos(const char *pos, uint line) const
+{
+    const File *f = fileAt(pos);
+    if (!f || line == 0)
+        return 0;
+    return static_cast<uint>(pos - f->start) - f->lineStarts[line - 1];
+}
+
+// -----------------------------------------------------------------------------------------
+
+const size_t TokenCursor::RingSize;
+
+TokenCursor::TokenCursor()
+    : _tokens(nullptr)
+    , _lexer(nullptr)
+    , _idx(0)
+    , _head(0)
+    , _count(0)
+{ }
+
+void TokenCursor::reset(const TokenList *tokens)
+{
+    _tokens = tokens;
+    _lexer = nullptr;
+    _idx = _head = _count = 0;
+    _last = LexToken();
 }
 
-bool Lexer::tryAccept(LexToken &tok)
+void TokenCursor::reset(Lexer *streamingLexer)
 {
-    if (!tok.isValid()) {
-        rewind();
-        return false;
+    _tokens = nullptr;
+    _lexer = streamingLexer;
+    _idx = _head = _count = 0;
+    _last = LexToken();
+}
+
+LexToken TokenCursor::next()
+{
+    if (_tokens) {
+        if (_idx < _tokens->size())
+            _last = _tokens->at(_idx++);
+        else
+            _last = LexToken();
+        return _last;
     }
-    tokens.push_back(tok);
 
-    _curPos = tok.pos + tok.len;
-    accept();
-    return true;
+    fill(1);
+    if (_count == 0)
+        return _last = LexToken();
+    _last = _ring[_head];
+    _head = (_head + 1) & (RingSize - 1);
+    --_count;
+    return _last;
 }
 
-bool Lexer::accept()
+LexToken TokenCursor::peek(size_t inc)
 {
-    assert(_curPos > _acceptedPos && "Accept did not advance");
-    _acceptedPos = _curPos;
-    return true;
+    if (_tokens)
+        return _idx + inc < _tokens->size() ? _tokens->at(_idx + inc) : LexToken();
+
+    assert(inc < RingSize && "peek further than the ring buffer holds");
+    fill(inc + 1);
+    if (inc >= _count)
+        return LexToken();
+    return _ring[(_head + inc) & (RingSize - 1)];
 }
 
-void Lexer::rewind()
+void TokenCursor::fill(size_t cnt)
 {
-   _curPos = _acceptedPos;
+    // pull from the lexer until cnt tokens are buffered or it runs dry
+    while (_lexer && _count < cnt) {
+        LexToken tok = _lexer->streamNext();
+        if (!tok.isValid()) {
+            _lexer = nullptr;
+            break;
+        }
+        _ring[(_head + _count) & (RingSize - 1)] = tok;
+        ++_count;
+    }
 }
@@ -4,9 +4,12 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <deque>
+#include <utility>
+#include <ostream>
+#include "interner.h"
 
 namespace Cmp {
-class Matches;
 
 // create one for each token
 class LexToken
@@ -15,24 +18,99 @@ public:
     enum Tokens { Undefined, NewLine, //Indent, Dedent,  // wait with these
                   Comment, OpenBrace, CloseBrace, OpenParen, CloseParen,
                   OpenBracket, CloseBracket,
-                  SemiColon, KwInt, KwReturn, Identifier,
+                  SemiColon,
+                  // operators
+                  Plus, Minus, Star, Slash, Percent, Tilde, Exclamation,
+                  Ampersand, Pipe, Caret, Less, Greater, Assign,
+                  ShiftLeft, ShiftRight, LessEqual, GreaterEqual,
+                  EqualEqual, NotEqual, AndAnd, OrOr,
+                  KwInt, KwReturn, Identifier,
                   // these must be in order 1base, 8base, 10base, 16 base etc
                   BinaryLitteral, OctalLitteral, IntLitteral, HexLitteral, FloatLitteral,
                   SglQteLitteral, DblQteLitteral
                 };
-    explicit LexToken(Tokens type, const char* pos, size_t len);
+    explicit LexToken(Tokens type, const char* pos, size_t len, uint64_t value = 0);
     explicit LexToken(); // undefined token
-    LexToken(const LexToken &other);
-    LexToken &operator=(const LexToken &other);
     bool isValid() const { return type != Undefined; }
+    bool isNumber() const { return type >= BinaryLitteral && type <= FloatLitteral; }
+    bool isInteger() const { return type >= BinaryLitteral && type <= HexLitteral; }
+    bool hasValue() const { return hasValue(type); }
+    static bool hasValue(Tokens t) { return (t >= BinaryLitteral && t <= FloatLitteral) || t == Identifier; }
+    // decoded by the lexer, no need to parse srcStr again
+    uint32_t intValue() const { return static_cast<uint32_t>(value); }
+    double floatValue() const;
+    // Identifier, id in the lexers Interner
+    Interner::SymbolId symbol() const { return static_cast<Interner::SymbolId>(value); }
     const char *type_to_cstr() const;
     std::string srcStr() const { return std::string(pos, len); }
-    const Tokens type;
+    Tokens type;
     const char* pos;
-    const size_t len;
+    size_t len;
+    uint64_t value; // number litterals (a float as its bit pattern), symbol ids
 };
 
+// ---------------------------------------------------------------------
+
+// token storage for a file, kept as parallel arrays
+// (32bit offset from base, 16bit length, 8bit kind) = 7 bytes a token
+// instead of 24 for a LexToken, tokens are rebuilt on access
+class TokenList
+{
+    const char *_base;
+    std::vector<uint32_t> _offsets;
+    std::vector<uint16_t> _lens;
+    std::vector<uint8_t> _kinds;
+    // tokens >= 0xFFFF chars (big comments), token index, length
+    std::vector<std::pair<uint32_t, uint32_t> > _longLens;
+    // decoded number litterals and identifier ids, in token order
+    std::vector<uint64_t> _values;
+    // per 64 tokens a bit for each that has a value and how many values
+    // came before, value(i) is a popcount away
+    std::vector<uint64_t> _valueBits;
+    std::vector<uint32_t> _valuesBefore;
+public:
+    static const uint16_t LongLen = 0xFFFF;
+
+    class const_iterator {
+        const TokenList *_list;
+        size_t _idx;
+    public:
+        const_iterator(const TokenList *list, size_t idx) : _list(list), _idx(idx) {}
+        LexToken operator*() const { return _list->at(_idx); }
+        const_iterator &operator++() { ++_idx; return *this; }
+        bool operator!=(const const_iterator &other) const { return _idx != other._idx; }
+        bool operator==(const const_iterator &other) const { return _idx == other._idx; }
+    };
+
+    explicit TokenList(const char *base = nullptr);
+
+    void setBase(const char *base) { _base = base; }
+    const char *base() const { return _base; }
+    size_t size() const { return _kinds.size(); }
+    bool empty() const { return _kinds.empty(); }
+    void clear();
+    void reserve(size_t n);
+    void shrink_to_fit();
+
+    // tok.pos must be within 4GB from base
+    void push_back(const LexToken &tok);
+
+    LexToken::Tokens type(size_t i) const { return static_cast<LexToken::Tokens>(_kinds[i]); }
+    const char *pos(size_t i) const { return _base + _offsets[i]; }
+    size_t len(size_t i) const { return _lens[i] != LongLen ? _lens[i] : longLen(i); }
+    uint64_t value(size_t i) const;
+    LexToken at(size_t i) const { return LexToken(type(i), pos(i), len(i), value(i)); }
+    LexToken operator[](size_t i) const { return at(i); }
+    LexToken back() const { return at(size() - 1); }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, size()); }
+
+    size_t memoryUsage() const;
 
+private:
+    size_t longLen(size_t i) const;
+};
 
 // ---------------------------------------------------------------------
 
@@ -40,27 +118,78 @@ public:
 // creates a token for each
 class Lexer
 {
-    const char *_start, *_curPos, *_acceptedPos;
-    bool _breakOnSyntaxError;
+public:
+    typedef TokenList T_Tokens;
+    // offset where each line starts
+    typedef std::vector<uint32_t> T_LineStarts;
+    typedef uint32_t FileId;
+    static const FileId NoFile = 0xFFFFFFFF;
+
+    // a tokenized file, owned by the lexer, stays at the same address
+    // for the lexers lifetime, tokenizing the same name again reuses it
+    // tokens only holds significant tokens, comments and newlines go in
+    // trivia, triviaNext[i] is the index in tokens that follows trivia[i]
+    struct File {
+        std::string name;
+        const char *start, *end;
+        T_Tokens tokens;
+        T_Tokens trivia;
+        std::vector<uint32_t> triviaNext;
+        T_LineStarts lineStarts;
+        bool failed; // lexing stopped or skipped on an error
+
+        // [first, last) range in trivia in front of tokens[tokIdx]
+        std::pair<size_t, size_t> triviaBefore(size_t tokIdx) const;
+    };
+
+private:
+    const char *_start, *_curPos;
+    File *_file; // the one being tokenized
+    std::deque<File> _files;
+    std::map<std::string, FileId> _fileIds;
+    bool _breakOnSyntaxError,
+         _failed,   // current file had errors
+         _stopped;  // no more tokens from current file
+    // why a scanner rejected the token at _curPos, lexToken reports it
+    // with the syntax error
+    const char *_rejected;
+    std::ostream *_err;
+    Interner _interner; // identifiers of all files
 public:
     explicit Lexer(bool breakOnSyntaxError = true);
     ~Lexer();
 
+    // lex the whole file into its token store
     bool tokenize(const char *srcStr[], const char* filename);
 
-    std::string to_string(const char* filename);
+    // pull mode, tokens are handed out one by one and never stored,
+    // streamNext() returns a Undefined token at the end or on a stopping error
+    void beginStream(const char *srcStr[], const char* filename);
+    LexToken streamNext();
+    bool streamFailed() const { return _failed; }
+
+    std::string to_string(const char* filename) const;
+
+    uint lineForToken(const LexToken &tok) const;
 
-    uint lineForToken(LexToken &tok);
+    // NoFile if filename is not tokenized
+    FileId fileId(const char *filename) const;
+    const File *file(FileId id) const { return id < _files.size() ? &_files[id] : nullptr; }
 
-    // filename, tokens
-    typedef std::vector<LexToken> T_Tokens;
-    std::map<const char*, T_Tokens> files;
+    // what, the line of errPos and a caret under it
+    void syntaxError(const char* errPos, const char *what = "Syntax Error") const;
 
-    void syntaxError(const char* errPos);
+    // where diagnostics go, std::cerr by default
+    std::ostream &errorStream() const { return *_err; }
+    Interner &interner() { return _interner; }
+    const Interner &interner() const { return _interner; }
+    void setErrorStream(std::ostream *err) { _err = err; }
 private:
-    LexToken matchFunc(const Matches *matches);
+    void beginFile(const char *src, const char *filename);
+    void endFile();
+    LexToken lexToken(); // next token including trivia
 
-    void space();
+    bool space();
     LexToken newLine();
     LexToken comment();
     LexToken keyWord(const char *start, const char *end);
@@ -72,15 +201,42 @@ private:
     inline const char *curPos() const { return _curPos; };
     inline const char *nextPos() { return ++_curPos;};
     inline const char *peek(int inc = 1) const { return _curPos + inc; }
-    bool tryAccept(LexToken &tok);
-    bool accept();
-    void rewind();
+    void addLine(const char *newLinePos);
+    const File *fileAt(const char *pos) const;
     uint lineAtPos(const char *pos) const;
-    T_Tokens tokens;
-
+    uint columnAtPos(const char *pos, uint line) const;
 };
 
 
+// ---------------------------------------------------------------------
+
+// significant tokens for the parser, walks a tokenized file or pulls
+// from a streaming lexer through a ring buffer, so only RingSize tokens
+// are alive at a time
+class TokenCursor
+{
+public:
+    static const size_t RingSize = 16; // power of 2, max lookahead
+
+    explicit TokenCursor();
+    void reset(const TokenList *tokens);
+    void reset(Lexer *streamingLexer);
+
+    LexToken next();
+    LexToken peek(size_t inc = 0); // inc < RingSize when streaming
+    LexToken last() const { return _last; } // last one handed out by next()
+
+private:
+    void fill(size_t cnt);
+
+    const TokenList *_tokens;
+    Lexer *_lexer;
+    size_t _idx;
+    LexToken _ring[RingSize];
+    size_t _head, _count;
+    LexToken _last;
+};
+
 } //namespace Cmp
 
 #endif // LEXER_H
@@ -1,55 +1,452 @@
 #include <iostream>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <stdlib.h>
 #include <getopt.h>
 #include <ctype.h>
 #include <fstream>
-#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 #include "lexer.h"
 #include "parser.h"
+#include "constfolder.h"
+#include "irbuilder.h"
 #include "generator.h"
+#include "sourcemanager.h"
+#include "emitter.h"
+#include "x86encoder.h"
+#include "elfwriter.h"
+#include "jit.h"
+#include "peephole.h"
+#include "timereport.h"
 
 using namespace std;
 
 void print_usage(const char *progname) {
 
-    if (optopt == 'c')
+    if (optopt == 'c' || optopt == 'j' || optopt == 'o')
         fprintf (stderr, "Option -%c requires an argument.\n", optopt);
     else if (isprint (optopt))
         fprintf (stderr, "Unknown option `-%c'.\n", optopt);
     else {
-        cout << "Usage " << progname << " -c path to file";
+        cout << "Usage " << progname << " [-a] [-l] [-d] [-ir] [-S] [-G] [-g] [-m32|-m64] [--run] [-j jobs] [-o outfile] file.c...\n"
+             << "  -ir    dump the intermediate code to file.c.ir\n"
+             << "  -S     keep the assembler code in file.c.S\n"
+             << "  -G     assemble and link with gcc instead of the built in backend\n"
+             << "  -g     keep the frame pointer in every function, for debuggers\n"
+             << "  -m32   generate i386 code, the default\n"
+             << "  -m64   generate x86-64 code for the SysV ABI\n"
+             << "  --run  run main of each file in this process and print what it returns\n"
+             << "  --no-fold      don't evaluate constant expressions at compile time\n"
+             << "  --no-peephole  leave the generated instructions as they are\n"
+             << "  --no-regalloc  keep every temporary on the stack\n"
+             << "  --size-report  instruction count per function before and after peephole,\n"
+             << "                 and what leaving out frames saved\n"
+             << "  -ftime-report  time and counters for each phase, on stderr\n"
+             << "  --time-report-json file  the same as a JSON array, one object per input file\n";
         fprintf (stdout,
                  "Unknown option character `\\x%x'.\n",
                  optopt);
     }
 }
 
-int main(int argc, char* argv[]) {
+struct Options {
     bool astflag = false;
     bool lexflag = false;
     bool dotflag = false;
-    char *outfile = nullptr;
-    int index;
+    bool irflag = false;  // write file.c.ir
+    bool asmflag = false; // write file.c.S
+    bool gccflag = false; // link with gcc, not our own ELF writer
+    bool debugflag = false; // keep %ebp frames
+    bool runflag = false; // jit and run, no executable
+    bool fold = true;
+    bool peephole = true;
+    bool regalloc = true;
+    bool sizeReport = false;
+    bool timeReport = false;
+    const char *timeJson = nullptr; // -ftime-report as JSON to this file
+    bool timing() const { return timeReport || timeJson; }
+    Cmp::Target target = Cmp::TargetI386;
+    const char *outfile = nullptr;
+};
+
+// result of one translation unit, printed in command line order
+struct UnitResult {
+    stringstream out, err;
+    int status = 0;
+    Cmp::TimeReport times;
+};
+
+// size of a file we wrote, 0 if it isn't there
+static size_t fileSize(const string &name)
+{
+    struct stat st;
+    return stat(name.c_str(), &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+}
+
+// compile one file, all state is local so units can run on any thread
+static int compileUnit(const Options &opts, const string &filename, UnitResult &res)
+{
+    ostream &err = res.err;
+    Cmp::TimeReport &times = res.times;
+    string outname = filename == "-" ? string("a.out") // stdin
+                                     : string(filename.c_str(), filename.length() -2); // cut the '.c'
+    if (opts.outfile)
+        outname = opts.outfile;
+
+    times.start(Cmp::TimeReport::Read);
+    Cmp::SourceManager sources;
+    const Cmp::SourceBuffer *src = sources.load(filename.c_str());
+    if (!src) {
+        err << "Could not open filen: " << filename << " (" << strerror(errno) << ")\n";
+        return 1;
+    }
+    times.counters().bytesRead = src->size();
+
+    Cmp::Lexer lex(true);
+    lex.setErrorStream(&err);
+    const char *cstr = src->data();
+
+    // the dump needs every token, lex the whole file up front. So does
+    // the time report, to tell lexing from parsing
+    if (opts.lexflag || opts.timing()) {
+        times.start(Cmp::TimeReport::Lex);
+        lex.tokenize(&cstr, filename.c_str());
+        times.stop();
+        if (const Cmp::Lexer::File *f = lex.file(lex.fileId(filename.c_str())))
+            times.counters().tokens = f->tokens.size();
+    }
+
+    if (opts.lexflag) {
+        string lexfn = filename;
+        lexfn += ".lex";
+        ofstream olex(lexfn);
+        if (olex.is_open()) {
+            olex << lex.to_string(filename.c_str());
+        }
+        olex.close();
+    }
+
+    // parse to a AST
+    times.start(Cmp::TimeReport::Parse);
+    Cmp::Parser parser(&lex, filename.c_str());
+    if (!opts.lexflag && !opts.timing()) {
+        // stream tokens from the lexer, they are never all in memory
+        parser.parseStream(cstr, filename.c_str());
+    }
+    // after the parse either way, the diagnostics come out in the same order
+    if (lex.streamFailed())
+        err << "Failed to tokenize file: " << filename << "\n";
+
+    times.stop();
+    if (!parser.isValid()) {
+        err << "Failed to parse file:" << filename << endl;
+        return 1;
+    }
+    times.counters().astNodes = parser.ast().size();
+
+    // constant expressions become single literals, -a shows what changed
+    if (opts.fold) {
+        times.start(Cmp::TimeReport::Fold);
+        Cmp::ConstantFolder folder;
+        folder.run(parser.ast());
+        times.stop();
+    }
+
+    if (opts.astflag) {
+        string astfn = filename;
+        astfn += ".ast";
+        ofstream oast(astfn);
+        if (oast.is_open())
+            oast<< parser.to_string();
+        oast.close();
+    }
+
+    if (opts.dotflag) {
+        string dotfn = filename; dotfn += ".dot";
+        ofstream odot(dotfn);
+        if (odot.is_open())
+            odot << parser.to_dot();
+        odot.close();
+    }
+
+    // lower to IR, checked before anything uses it
+    times.start(Cmp::TimeReport::Lower);
+    Cmp::IrProgram ir;
+    Cmp::IrBuilder builder(&lex);
+    if (!builder.build(parser.ast(), ir) || !ir.verify(err)) {
+        err << "Failed to lower file: " << filename << "\n";
+        return 1;
+    }
+    times.stop();
+
+    if (opts.irflag) {
+        string irfn = filename; irfn += ".ir";
+        ofstream oir(irfn);
+        if (oir.is_open())
+            oir << ir.to_string();
+        oir.close();
+    }
+
+    // generate asm code
+    times.start(Cmp::TimeReport::Generate);
+    Cmp::Generator gen(err, opts.target, opts.debugflag);
+    gen.setStackOnly(!opts.regalloc);
+    if (!gen.generate(ir)) {
+        err << "Failed to generate assembler code\n";
+        return 1;
+    }
+    times.stop();
+
+    if (opts.peephole) {
+        times.start(Cmp::TimeReport::Peephole);
+        Cmp::Peephole peep;
+        peep.run(gen.code());
+        times.stop();
+        if (opts.sizeReport)
+            peep.report(gen.code(), res.out);
+    }
+    if (opts.sizeReport)
+        gen.frameReport(res.out);
+    times.counters().instructions = gen.code().instructionCount();
+
+    string asmFileName(filename); asmFileName += ".S";
+    if (opts.asmflag || opts.gccflag) {
+        times.start(Cmp::TimeReport::WriteAsm);
+        Cmp::Emitter asmText;
+        gen.code().to_asm(asmText);
+        if (!asmText.writeFile(asmFileName.c_str())) {
+            err << "Could not write " << asmFileName << ": " << strerror(errno) << "\n";
+            return 1;
+        }
+        times.stop();
+        times.counters().outputBytes += asmText.size();
+    }
+
+    if (opts.runflag) {
+        // encode for this host and call main directly, no files, no processes
+        times.start(Cmp::TimeReport::Run);
+        vector<uint8_t> code;
+        Cmp::X86Encoder encoder(err, Cmp::X86Encoder::Mode64);
+        auto mainLbl = gen.code().findLabel("main");
+        if (mainLbl == Cmp::InstList::NoLabel) {
+            err << "No main function to run in " << filename << "\n";
+            return 1;
+        }
+        if (!encoder.encode(gen.code(), code))
+            return 1;
+        times.counters().outputBytes += code.size();
+
+        Cmp::Jit jit;
+        if (!jit.load(code)) {
+            err << "Could not map code for " << filename << ": " << strerror(errno) << "\n";
+            return 1;
+        }
+        int result = 0, sig = 0;
+        if (!jit.run(static_cast<size_t>(encoder.labelPos(mainLbl)), result, sig)) {
+            err << filename << ": crashed with signal " << sig << " (" << strsignal(sig) << ")\n";
+            return 1;
+        }
+        times.stop();
+        res.out << filename << ": " << result << "\n";
+        return 0;
+    }
+
+    if (!opts.gccflag) {
+        // encode and write the executable ourself, no assembler or linker
+        times.start(Cmp::TimeReport::Encode);
+        bool x86_64 = opts.target == Cmp::TargetX86_64;
+        vector<uint8_t> code;
+        size_t entry;
+        Cmp::X86Encoder encoder(err, x86_64 ? Cmp::X86Encoder::Mode64 : Cmp::X86Encoder::Mode32);
+        if (!encoder.encodeExecutable(gen.code(), code, entry))
+            return 1;
+        Cmp::ElfWriter elf(x86_64 ? Cmp::ElfWriter::X86_64 : Cmp::ElfWriter::I386);
+        if (!elf.write(outname.c_str(), code, entry)) {
+            err << "Could not write " << outname << ": " << strerror(errno) << "\n";
+            return 1;
+        }
+        times.stop();
+        times.counters().outputBytes += fileSize(outname);
+        return 0;
+    }
+
+    // invoke gcc assembler, capture its output per unit instead of
+    // a shared temp file
+    times.start(Cmp::TimeReport::Gcc);
+    string gccCmd = string(opts.target == Cmp::TargetX86_64 ? "gcc -m64" : "gcc -m32") +
+                    " -g " + asmFileName + " -o " + outname + " 2>&1";
+    FILE *gcc = popen(gccCmd.c_str(), "r");
+    if (!gcc) {
+        err << "Could not run gcc: " << strerror(errno) << "\n";
+        return 1;
+    }
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), gcc)) > 0)
+        res.out.write(buf, static_cast<streamsize>(n));
+    int status = pclose(gcc);
+    times.stop();
+    times.counters().outputBytes += fileSize(outname);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1;
+}
+
+// run all units on a pool of jobs threads, results are printed in input
+// order as soon as each one and all before it are done
+static int compileAll(const Options &opts, const vector<string> &files, unsigned jobs)
+{
+    vector<UnitResult> results(files.size());
+    vector<bool> done(files.size(), false);
+    mutex mtx;
+    condition_variable cond;
+    atomic<size_t> nextUnit(0);
+
+    auto worker = [&]() {
+        for (size_t i = nextUnit++; i < files.size(); i = nextUnit++) {
+            results[i].status = compileUnit(opts, files[i], results[i]);
+            // a failed unit stops in the middle of a phase
+            results[i].times.stop();
+            if (opts.timeReport)
+                results[i].times.print(results[i].err, files[i].c_str());
+            lock_guard<mutex> lock(mtx);
+            done[i] = true;
+            cond.notify_all();
+        }
+    };
+
+    // jobs workers, the main thread only prints
+    vector<thread> pool;
+    if (jobs > 1 && files.size() > 1) {
+        for (unsigned t = 0; t < jobs && t < files.size(); ++t)
+            pool.emplace_back(worker);
+    } else
+        worker(); // no threads for a single job
+
+    int status = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        {
+            unique_lock<mutex> lock(mtx);
+            cond.wait(lock, [&]() { return done[i]; });
+        }
+        cout << results[i].out.str() << flush;
+        cerr << results[i].err.str() << flush;
+        if (results[i].status)
+            status = results[i].status;
+    }
+
+    for (auto &t : pool)
+        t.join();
+
+    if (opts.timeJson) {
+        ofstream ojson(opts.timeJson);
+        ojson << "[\n";
+        for (size_t i = 0; i < files.size(); ++i) {
+            ojson << "  ";
+            results[i].times.json(ojson, files[i].c_str());
+            ojson << (i + 1 < files.size() ? ",\n" : "\n");
+        }
+        ojson << "]\n";
+        if (!ojson) {
+            cerr << "Could not write " << opts.timeJson << "\n";
+            status = 1;
+        }
+    }
+
+    return status;
+}
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    unsigned jobs = 1;
     int c;
 
     opterr = 0;
 
-    while ((c = getopt(argc, argv, "haldc:")) != -1)
+    // -run works as well as --run
+    static const struct option longOpts[] = {
+        { "run", no_argument, nullptr, 'r' },
+        { "ir", no_argument, nullptr, 'i' },
+        { "no-fold", no_argument, nullptr, 'F' },
+        { "no-peephole", no_argument, nullptr, 'N' },
+        { "no-regalloc", no_argument, nullptr, 'A' },
+        { "size-report", no_argument, nullptr, 'R' },
+        { "m32", no_argument, nullptr, '3' },
+        { "m64", no_argument, nullptr, '6' },
+        { "ftime-report", no_argument, nullptr, 'T' },
+        { "time-report-json", required_argument, nullptr, 'J' },
+        { "help", no_argument, nullptr, 'h' },
+        { nullptr, 0, nullptr, 0 }
+    };
+
+    while ((c = getopt_long_only(argc, argv, "haldgGSc:j:o:", longOpts, nullptr)) != -1)
         switch (c)
         {
         case 'a':
-            astflag = 1;
+            opts.astflag = 1;
             break;
         case 'l':
-            lexflag = 1;
+            opts.lexflag = 1;
             break;
         case 'd':
-            dotflag = true;
+            opts.dotflag = true;
+            break;
+        case 'i':
+            opts.irflag = true;
+            break;
+        case 'S':
+            opts.asmflag = true;
+            break;
+        case 'G':
+            opts.gccflag = true;
+            break;
+        case 'g':
+            opts.debugflag = true;
+            break;
+        case 'r':
+            if (!Cmp::Jit::supported()) {
+                fprintf(stderr, "--run needs an x86-64 host\n");
+                return 1;
+            }
+            opts.runflag = true;
+            break;
+        case 'F':
+            opts.fold = false;
+            break;
+        case 'N':
+            opts.peephole = false;
+            break;
+        case 'A':
+            opts.regalloc = false;
+            break;
+        case 'R':
+            opts.sizeReport = true;
+            break;
+        case '3':
+            opts.target = Cmp::TargetI386;
+            break;
+        case '6':
+            opts.target = Cmp::TargetX86_64;
+            break;
+        case 'T':
+            opts.timeReport = true;
+            break;
+        case 'J':
+            opts.timeJson = optarg;
+            break;
+        case 'j':
+            jobs = static_cast<unsigned>(atoi(optarg));
+            if (jobs < 1)
+                jobs = thread::hardware_concurrency() ? thread::hardware_concurrency() : 1;
             break;
         case 'o':
-            outfile = optarg;
+            opts.outfile = optarg;
             break;
         case '?': case 'h':
             print_usage(argv[0]);
@@ -59,92 +456,18 @@ int main(int argc, char* argv[]) {
             abort ();
         }
 
-    //printf ("aflag = %d, bflag = %d, cvalue = %s\n",
-    //        aflag, bflag, cvalue);
-
-    string filename = argv[argc-1];
-    string outname(filename.c_str(), filename.length() -2); // cut the '.c'
-    if (outfile)
-        outname = outfile;
-    //for (index = optind; index < argc; index++)
-    //    printf ("Non-option argument %s\n", argv[index]);
-
-    ifstream infile(filename);
-    if (infile.is_open()) {
-
-        std::string str((std::istreambuf_iterator<char>(infile)),
-                         std::istreambuf_iterator<char>());
-        infile.close();
-
-        Cmp::Lexer lex(true);
-        const char *cstr = str.c_str();
-        if (!lex.tokenize(&cstr, filename.c_str()))
-            fprintf(stderr, "Failed to tokenize file: %s\n", filename.c_str());
-//        else
-//            fprintf(stdout, "Successfully tokenized file: %s\n", filename);
-
-        if (lexflag) {
-            string lexfn = filename;
-            lexfn += ".lex";
-            ofstream olex(lexfn);
-            if (olex.is_open()) {
-                olex << lex.to_string(filename.c_str());
-            }
-            olex.close();
-        }
-
-        // parse to a AST
-        Cmp::Parser parser(&lex, filename.c_str());
-        if (parser.isValid()) {
-            //cout << "Succesfully parsed to a ast" << endl;
-            if (astflag) {
-                string astfn = filename;
-                astfn += ".ast";
-                ofstream oast(astfn);
-                if (oast.is_open())
-                    oast<< parser.to_string();
-                oast.close();
-            }
-
-            if (dotflag) {
-                string dotfn = filename; dotfn += ".dot";
-                ofstream odot(dotfn);
-                if (odot.is_open())
-                    odot << parser.to_dot(parser.root());
-                odot.close();
-            }
-
-            // generate asm code
-            Cmp::Generator gen(&parser, &lex);
-            string asmStr = gen.generate(parser.root());
-            if (!asmStr.empty()) {
-                string asmFileName(filename); asmFileName += ".S";
-                ofstream asmFile(asmFileName);
-                if (asmFile.is_open()) {
-                    asmFile << asmStr;
-                    asmFile.close();
-
-                    // invoke gcc assembler
-                    string gccCmd = "gcc -m32 -g " + asmFileName + " -o " + outname + "  >test.txt";
-                    int status = std::system(gccCmd.c_str());
-                    std::cout << std::ifstream("test.txt").rdbuf();
-                    std::system("rm test.txt");
-                    //std::cout << "Exit code: " << WEXITSTATUS(status) << std::endl;
-                }
-            } else {
-                cerr << "Failed to generate assembler code\n";
-                exit(1);
-            }
+    vector<string> files;
+    for (int index = optind; index < argc; index++)
+        files.push_back(argv[index]);
 
-        } else {
-            cerr << "Failed to parse file:" << filename << endl;
-            exit(1);
-        }
-
-    } else {
-        fprintf(stderr, "Could not open filen: %s\n", filename.c_str());
-        exit(1);
+    if (files.empty()) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (opts.outfile && files.size() > 1) {
+        fprintf(stderr, "-o can only be used with a single input file\n");
+        return 1;
     }
 
-    exit(0);
+    exit(compileAll(opts, files, jobs));
 }
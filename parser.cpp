@@ -10,12 +10,53 @@
 using namespace Cmp;
 using namespace std;
 
+namespace {
+
+// operator table for parseOperators, indexed by token type
+// binary precedence 0 means not a binary operator, unary likewise
+struct OpInfo {
+    uint8_t binPrec, unaryPrec;
+    bool rightAssoc;
+};
+
+const uint8_t UnaryPrec = 11;
+
+constexpr OpInfo opInfoOf(int t)
+{
+    return t == LexToken::OrOr ? OpInfo{ 1, 0, false } :
+           t == LexToken::AndAnd ? OpInfo{ 2, 0, false } :
+           t == LexToken::Pipe ? OpInfo{ 3, 0, false } :
+           t == LexToken::Caret ? OpInfo{ 4, 0, false } :
+           t == LexToken::Ampersand ? OpInfo{ 5, 0, false } :
+           (t == LexToken::EqualEqual || t == LexToken::NotEqual) ? OpInfo{ 6, 0, false } :
+           (t == LexToken::Less || t == LexToken::LessEqual ||
+            t == LexToken::Greater || t == LexToken::GreaterEqual) ? OpInfo{ 7, 0, false } :
+           (t == LexToken::ShiftLeft || t == LexToken::ShiftRight) ? OpInfo{ 8, 0, false } :
+           (t == LexToken::Plus || t == LexToken::Minus) ? OpInfo{ 9, UnaryPrec, false } :
+           (t == LexToken::Star || t == LexToken::Slash || t == LexToken::Percent) ? OpInfo{ 10, 0, false } :
+           (t == LexToken::Tilde || t == LexToken::Exclamation) ? OpInfo{ 0, UnaryPrec, true } :
+           OpInfo{ 0, 0, false };
+}
+
+constexpr OpInfo _opInfo[] = {
+#define CMP_OP4(n) opInfoOf(n), opInfoOf(n+1), opInfoOf(n+2), opInfoOf(n+3)
+    CMP_OP4(0), CMP_OP4(4), CMP_OP4(8), CMP_OP4(12), CMP_OP4(16), CMP_OP4(20),
+    CMP_OP4(24), CMP_OP4(28), CMP_OP4(32), CMP_OP4(36), CMP_OP4(40), CMP_OP4(44)
+#undef CMP_OP4
+};
+static_assert(sizeof(_opInfo) / sizeof(_opInfo[0]) > LexToken::DblQteLitteral,
+              "operator table must cover all token types");
+
+inline const OpInfo &opInfo(LexToken::Tokens t) { return _opInfo[t]; }
+
+} // namespace
+
 
 
 // -----------------------------------------------------------
 
 
-ParseNode::ParseNode(ParseNode *parent, LexToken *tok, ParseNode::Kind type)
+ParseNode::ParseNode(ParseNode *parent, const LexToken &tok, ParseNode::Kind type)
     : _parent(parent)
     , _leftOperand(nullptr)
     , _rightOperand(nullptr)
@@ -24,39 +65,11 @@ ParseNode::ParseNode(ParseNode *parent, LexToken *tok, ParseNode::Kind type)
     , _kind(type)
 { }
 
-ParseNode::~ParseNode()
-{
-    if (_parent)
-        _parent->removeChild(this);
-
-    delete _leftOperand;
-    delete _rightOperand;
-    delete _operator;
-
-    auto oldRight = _rightOperand;
-    auto oldLeft = _leftOperand;
-    auto oldOper = _operator;
-
-    _leftOperand = _rightOperand = _operator = nullptr;
-
-    if (oldLeft)
-        oldLeft->setParent(nullptr);
-    if (oldRight)
-        oldRight->setParent(nullptr);
-    if (oldOper)
-        oldOper->setParent(nullptr);
-
-    delete oldRight;
-    delete oldLeft;
-    delete oldOper;
-}
-
 void ParseNode::setLeftOper(ParseNode *left)
 {
     assert(left != _parent);
     assert(left != this);
     assert(_leftOperand != left);
-    delete _leftOperand;
     _leftOperand = left;
 }
 
@@ -65,7 +78,6 @@ void ParseNode::setRightOper(ParseNode *right)
     assert(right != _parent || !right);
     assert(right != this);
     assert(_rightOperand != right || !right);
-    delete _rightOperand;
     _rightOperand = right;
 }
 
@@ -74,7 +86,6 @@ void ParseNode::setOperat(ParseNode *oper)
     assert(oper != _parent || !oper);
     assert(oper != this);
     assert(oper != _operator || !oper);
-    delete _operator;
     _operator = oper;
 }
 
@@ -99,9 +110,9 @@ void ParseNode::removeChild(ParseNode *child)
         _operator = nullptr;
 }
 
-const char *ParseNode::to_cstr() const
+const char *ParseNode::kind_to_cstr(ParseNode::Kind kind)
 {
-    switch (_kind) {
+    switch (kind) {
     case Undefined: return "Undefined";
     case Program:   return "Program";
     case Function:  return "Function";
@@ -110,6 +121,8 @@ const char *ParseNode::to_cstr() const
     case Expression:return "Expression";
     case Constant:  return "Constant";
     case DataType:  return "DataType";
+    case BinaryOp:  return "BinaryOp";
+    case UnaryOp:   return "UnaryOp";
     case EndMarker: return "EndMarker";
     }
     assert(0 && "No name Type in Paser, should not happen");
@@ -118,22 +131,111 @@ const char *ParseNode::to_cstr() const
 
 // -----------------------------------------------------------
 
+const FlatAst::NodeIdx FlatAst::NoNode;
+const uint32_t FlatAst::NoTok;
+const uint32_t FlatAst::Folded;
+
+FlatAst::FlatAst()
+{ }
+
+void FlatAst::clear()
+{
+    _nodes.clear();
+    _tokens.clear();
+}
+
+bool FlatAst::build(const ParseNode *root, const char *srcBase)
+{
+    clear();
+    _tokens.setBase(srcBase);
+    if (!root)
+        return true;
+
+    // explicit stack, deep trees must not blow the native stack
+    // parent index and which child slot of it to patch
+    struct Pending {
+        const ParseNode *n;
+        NodeIdx parent;
+        NodeIdx Node::*slot;
+    };
+    vector<Pending> stack;
+    stack.push_back(Pending{ root, NoNode, nullptr });
+
+    while (!stack.empty()) {
+        Pending p = stack.back();
+        stack.pop_back();
+
+        uint32_t tokIdx = NoTok;
+        if (p.n->lexToken()) {
+            if (_tokens.size() >= NoTok)
+                return false;
+            tokIdx = static_cast<uint32_t>(_tokens.size());
+            _tokens.push_back(*p.n->lexToken());
+        }
+
+        NodeIdx idx = static_cast<NodeIdx>(_nodes.size());
+        Node node = { static_cast<uint32_t>(p.n->kind()), tokIdx,
+                      NoNode, NoNode, NoNode };
+        _nodes.push_back(node);
+        if (p.parent != NoNode)
+            _nodes[p.parent].*p.slot = idx;
+
+        // reversed, left comes out first
+        if (p.n->rightOperand())
+            stack.push_back(Pending{ p.n->rightOperand(), idx, &Node::right });
+        if (p.n->operat())
+            stack.push_back(Pending{ p.n->operat(), idx, &Node::operat });
+        if (p.n->leftOperand())
+            stack.push_back(Pending{ p.n->leftOperand(), idx, &Node::left });
+    }
+
+    return true;
+}
+
+bool FlatAst::setConstant(NodeIdx i, uint32_t value)
+{
+    if (_tokens.size() >= NoTok)
+        return false;
+    // the new token points at the source of the one it replaces,
+    // appended last, a TokenList only grows at the end
+    LexToken tok = token(i);
+    uint32_t tokIdx = static_cast<uint32_t>(_tokens.size());
+    _tokens.push_back(LexToken(LexToken::IntLitteral, tok.pos, tok.len, value));
+
+    Node &node = _nodes[i];
+    node.kind = Folded | static_cast<uint32_t>(ParseNode::Constant);
+    node.tok = tokIdx;
+    node.left = node.right = NoNode;
+    return true;
+}
+
+void FlatAst::replace(NodeIdx i, NodeIdx with)
+{
+    Node &node = _nodes[i];
+    const Node &other = _nodes[with];
+    node.kind = other.kind | Folded;
+    node.tok = other.tok;
+    node.left = other.left;
+    node.right = other.right;
+}
+
+// -----------------------------------------------------------
+
 Parser::Parser(Lexer *lexer, const char *currentfile)
     : _root(nullptr)
+    , _srcBase(nullptr)
     , _lexer(lexer)
     //, _curTokIdx(0)
     , _currentfile(currentfile)
-    , _tokFile(nullptr)
+    , _dotEmptyNr(0)
 {
-    if (_lexer->files.find(_currentfile) != _lexer->files.end()) {
-        _tokFile = &_lexer->files.at(_currentfile);
+    if (_lexer->fileId(_currentfile) != Lexer::NoFile)
         parse();
-    }
 }
 
 Parser::~Parser()
 {
-    delete _root;
+    // nodes live in _arena, it frees them all at once
 }
 
 
@@ -142,91 +244,126 @@ bool Parser::parse(const char *srcStr, const char* otherfile)
 {
     if (otherfile && strncmp(otherfile, _currentfile, 2048) != 0) {
         _currentfile = otherfile;
-        if (_lexer->files.find(_currentfile) == _lexer->files.end()) {
+        if (_lexer->fileId(_currentfile) == Lexer::NoFile) {
             _lexer->tokenize(&srcStr, _currentfile);
         }
     }
 
-    if (_lexer->files.find(_currentfile) == _lexer->files.end() ||
-        _lexer->files.at(_currentfile).size() < 1)
+    const Lexer::File *file = _lexer->file(_lexer->fileId(_currentfile));
+    if (!file || file->tokens.size() < 1)
     {
-        cerr << "file " << _currentfile << " is not tokenized properly"<< endl;
+        _lexer->errorStream() << "file " << _currentfile << " is not tokenized properly"<< endl;
         return false;
     }
 
 
-    if (_root)
-        delete _root;
-
+    _arena.reset();
     _root = nullptr;
     //_curTokIdx = 0;
-    _tokFile = &_lexer->files.at(_currentfile);
-    _tokIt = _tokFile->begin();
+    _cursor.reset(&file->tokens);
+    _srcBase = file->start;
 
-    return parseProgram();
+    return parseProgram() && flatten();
+}
+
+bool Parser::parseStream(const char *srcStr, const char *filename)
+{
+    _currentfile = filename;
+    _arena.reset();
+    _root = nullptr;
+
+    _lexer->beginStream(&srcStr, _currentfile);
+    _cursor.reset(_lexer);
+    _srcBase = srcStr;
+    if (!_cursor.peek().isValid()) {
+        _lexer->errorStream() << "file " << _currentfile << " is not tokenized properly"<< endl;
+        return false;
+    }
+
+    return parseProgram() && flatten();
 }
 
 string Parser::to_string() const
 {
-    // go max left first to determine how far out we should be
+    // find how far left the tree goes to determine how far out we should be,
+    // pre-order so a parents offset is known before its children
     size_t leftDepth = 0;
-    for(auto n = _root; n != nullptr;) {
-        if (n->leftOperand()) {
-            n = n->leftOperand();
-            ++leftDepth;
-        } else
-            n = n->operat();
+    vector<long> offset(_flat.size(), 0);
+    for (FlatAst::NodeIdx n = 0; n < _flat.size(); ++n) {
+        if (_flat.left(n) != FlatAst::NoNode)
+            offset[_flat.left(n)] = offset[n] - 1;
+        if (_flat.right(n) != FlatAst::NoNode)
+            offset[_flat.right(n)] = offset[n] + 1;
+        if (_flat.operat(n) != FlatAst::NoNode)
+            offset[_flat.operat(n)] = offset[n];
+        if (offset[n] < 0 && static_cast<size_t>(-offset[n]) > leftDepth)
+            leftDepth = static_cast<size_t>(-offset[n]);
     }
 
     size_t longestName = 0;
     for (int i = 0; i < ParseNode::EndMarker; ++i) {
-        ParseNode n(nullptr, nullptr, static_cast<ParseNode::Kind>(i));
-        auto len = strlen(n.to_cstr());
+        auto len = strlen(ParseNode::kind_to_cstr(static_cast<ParseNode::Kind>(i)));
         if (len > longestName)
             longestName = len;
     }
 
 
     stringstream res;
-    recursePrint(_root, res, leftDepth, longestName);
+    if (!_flat.empty())
+        printTree(_flat.root(), res, leftDepth, longestName);
     return res.str();
 }
 
-string Parser::to_dot(ParseNode *root) const
+string Parser::to_dot() const
 {
     stringstream dot;
+    _dotNodeNrs.clear();
+    _dotEmptyNr = 0;
     dot << "digraph g{" << endl;
-    recurseDot(dot, root, string());
+    dotTree(dot, _flat.root());
     dot << "}" << endl;
     return dot.str();
 }
 
-void Parser::recursePrint(ParseNode *node, stringstream &res,
-                          size_t leftDepth, size_t longestname) const
+void Parser::printTree(FlatAst::NodeIdx node, stringstream &res,
+                       size_t leftDepth, size_t longestname) const
 {
 
     string fill(longestname, ' ');
 
-    for (auto n = node; n != nullptr; n = n->operat()) {
+    // node, left, right, then operat, same order as a recursive walk
+    // but on our own stack, expressions can be nested very deep
+    vector<pair<FlatAst::NodeIdx, size_t> > stack; // node, depth
+    stack.push_back(make_pair(node, leftDepth));
+    while (!stack.empty()) {
+        auto n = stack.back().first;
+        auto depth = stack.back().second;
+        stack.pop_back();
+
         // fill space left
-        for (size_t i = 0; i < leftDepth; ++i)
+        for (size_t i = 0; i < depth; ++i)
             res << fill;
 
-        res << n->to_cstr();
+        res << ParseNode::kind_to_cstr(_flat.kind(n));
+        if (_flat.folded(n) && _flat.kind(n) == ParseNode::Constant)
+            res << " (folded to " << static_cast<int32_t>(_flat.token(n).intValue()) << ")";
+        else if (_flat.folded(n))
+            res << " (folded)";
 
         // new line for my children
         res << endl;
 
-        if (n->leftOperand())
-            recursePrint(n->leftOperand(), res, leftDepth - 1, longestname);
-        if (n->rightOperand())
-            recursePrint(n->rightOperand(), res, leftDepth +1, longestname);
+        if (_flat.operat(n) != FlatAst::NoNode)
+            stack.push_back(make_pair(_flat.operat(n), depth));
+        if (_flat.right(n) != FlatAst::NoNode)
+            stack.push_back(make_pair(_flat.right(n), depth +1));
+        if (_flat.left(n) != FlatAst::NoNode)
+            stack.push_back(make_pair(_flat.left(n), depth - 1));
     }
 }
 
-void Parser::recurseDot(stringstream &dot, ParseNode *n, string parentName) const
+void Parser::dotTree(stringstream &dot, FlatAst::NodeIdx root) const
 {
-    if (!n) return;
     //        Program[shape = box];
     //        ProgramLeft[style = invis ];
     //        Program -> ProgramLeft[style = invis ];
@@ -238,53 +375,85 @@ void Parser::recurseDot(stringstream &dot, ParseNode *n, string parentName) cons
     //        FunctionRight [style = invis ];
     //        Function -> FunctionRight[style = invis];
     //        Statement -> Expression;
-    static map<string, int> nodeNrs;
 
-    string name = n->to_cstr();
-    string label = name ;
-    if (n->lexToken()) {
-        label += string("\\n(") + n->lexToken()->type_to_cstr() + ")"
-               + "\\n[" + string(n->lexToken()->pos, n->lexToken()->len) + "]";
+    // NoNode means an invisible placeholder for a missing operand
+    vector<pair<FlatAst::NodeIdx, string> > stack; // node, parentName
+    if (root != FlatAst::NoNode)
+        stack.push_back(make_pair(root, string()));
+    while (!stack.empty()) {
+        auto n = stack.back().first;
+        string parentName = stack.back().second;
+        stack.pop_back();
+        if (n == FlatAst::NoNode) {
+            emptyDot(dot, parentName);
+            continue;
+        }
+
+        string name = ParseNode::kind_to_cstr(_flat.kind(n));
+        string label = name ;
+        if (_flat.hasToken(n)) {
+            LexToken tok = _flat.token(n);
+            label += string("\\n(") + tok.type_to_cstr() + ")"
+                   + "\\n[" + tok.srcStr() + "]";
+        }
+        label = string("\"") + label + "\"";
+
+        if (_dotNodeNrs.find(name) == _dotNodeNrs.end())
+            _dotNodeNrs[name] = 0;
+        else
+            ++_dotNodeNrs[name];
+        string nameAndNr = name + std::to_string(_dotNodeNrs[name]);
+        dot << "    " << nameAndNr << "[label=" << label << "];" << endl;
+        if (!parentName.empty())
+            dot << "    " << parentName << "->" << nameAndNr << endl;
+
+        // left, operat, right, pushed in reverse
+        stack.push_back(make_pair(_flat.right(n), nameAndNr));
+        if (_flat.operat(n) != FlatAst::NoNode)
+            stack.push_back(make_pair(_flat.operat(n), nameAndNr));
+        stack.push_back(make_pair(_flat.left(n), nameAndNr));
     }
-    label = string("\"") + label + "\"";
-
-    if (nodeNrs.find(name) == nodeNrs.end())
-        nodeNrs[name] = 0;
-    else
-        ++nodeNrs[name];
-    string nameAndNr = name + std::to_string(nodeNrs[name]);
-    dot << "    " << nameAndNr << "[label=" << label << "];" << endl;
-    if (!parentName.empty())
-        dot << "    " << parentName << "->" << nameAndNr << endl;
-
-    if (n->leftOperand())
-        recurseDot(dot, n->leftOperand(), nameAndNr);
-    else
-        emptyDot(dot, nameAndNr);
-
-    if (n->operat())
-        recurseDot(dot, n->operat(), nameAndNr);
-
-    if (n->rightOperand())
-        recurseDot(dot, n->rightOperand(), nameAndNr);
-    else
-        emptyDot(dot, nameAndNr);
 }
 
 void Parser::emptyDot(stringstream &dot, string parentName) const
 {
-    static uint emptyNr = 0;
-    string emptyName = parentName + "_empty" + std::to_string(emptyNr++);
+    string emptyName = parentName + "_empty" + std::to_string(_dotEmptyNr++);
     dot << "    " << emptyName << "[label=\"\", shape=plain, style=invis];" << endl
         << "    " << parentName << "->" << emptyName << "[style=invis];" << endl;
 }
 
+bool Parser::flatten()
+{
+    if (!_flat.build(_root, _srcBase)) {
+        _lexer->errorStream() << "file " << _currentfile
+                              << " has too many tokens for the flat AST" << endl;
+        _flat.clear();
+        return false;
+    }
+    return true;
+}
+
 bool Parser::parseProgram()
 {
-    _root = new ParseNode(nullptr, nullptr, ParseNode::Program);
+    _symbols.clear();
+    _root = _arena.create<ParseNode>(nullptr, LexToken(), ParseNode::Program);
     bool res = parseFunction(_root);
+
+    // the function must be all there is. Reading to the end also makes
+    // a stream lex the rest, an error there fails the same way as it
+    // does when all tokens were lexed up front
+    if (res) {
+        auto tok = peek(0);
+        if (tok.isValid()) {
+            _lexer->syntaxError(tok.pos, "Unexpected tokens after the last function");
+            res = false;
+        } else {
+            const Lexer::File *file = _lexer->file(_lexer->fileId(_currentfile));
+            res = file && !file->failed;
+        }
+    }
     if (!res) {
-        delete _root;
+        _arena.reset();
         _root = nullptr;
     }
     return res;
@@ -294,6 +463,7 @@ bool Parser::parseFunction(ParseNode *parent)
 {
     bool res = true;
     ParseNode *node = nullptr;
+    auto mark = _arena.mark();
 
     // <int> <ident> '(' ')' '{' <statement> '}'
     do {
@@ -305,10 +475,19 @@ bool Parser::parseFunction(ParseNode *parent)
         res = failCheck(tok, LexToken::Identifier);
         if (!res) break;
 
-        node = new ParseNode(parent, tok, ParseNode::Function);
+        Symbol fn = { tok.symbol(), Symbol::Function, 0 };
+        if (!_symbols.define(fn)) {
+            _lexer->errorStream() << "Function " << tok.srcStr() << " is already defined, at line "
+                                  << _lexer->lineForToken(tok) << endl;
+            _lexer->syntaxError(tok.pos);
+            res = false;
+            break;
+        }
+
+        node = _arena.create<ParseNode>(parent, tok, ParseNode::Function);
         parent->setOperat(node);
 
-        auto retval = new ParseNode(node, retTypetok, ParseNode::DataType);
+        auto retval = _arena.create<ParseNode>(node, retTypetok, ParseNode::DataType);
         node->setLeftOper(retval);
 
         tok = nextTok();
@@ -323,7 +502,10 @@ bool Parser::parseFunction(ParseNode *parent)
         res = failCheck(tok, LexToken::OpenBrace);
         if (!res) break;
 
+        _symbols.enterScope(); // the function body
         res = parseStatement(node);
+        _symbols.leaveScope();
+        if (!res) break;
 
         tok = nextTok();
         res = failCheck(tok, LexToken::CloseBrace);
@@ -332,7 +514,7 @@ bool Parser::parseFunction(ParseNode *parent)
 
     if (!res && node) {
         parent->removeChild(node);
-        delete node;
+        _arena.rollback(mark); // node and all below it
     }
 
     return res;
@@ -342,6 +524,7 @@ bool Parser::parseStatement(ParseNode *parent)
 {
     bool res = true;
     ParseNode *node = nullptr;
+    auto mark = _arena.mark();
 
     // <return> <exp> ';'
     do {
@@ -349,10 +532,11 @@ bool Parser::parseStatement(ParseNode *parent)
         res = failCheck(tok, LexToken::KwReturn);
         if (!res) break;
 
-        node = new ParseNode(parent, tok, ParseNode::Statement);
+        node = _arena.create<ParseNode>(parent, tok, ParseNode::Statement);
         parent->setOperat(node);
 
         res = parseExpression(node);
+        if (!res) break;
 
         tok = nextTok();
         res = failCheck(tok, LexToken::SemiColon);
@@ -362,7 +546,7 @@ bool Parser::parseStatement(ParseNode *parent)
 
     if (!res && node) {
         parent->removeChild(node);
-        delete node;
+        _arena.rollback(mark); // node and all below it
     }
 
     return res;
@@ -372,13 +556,14 @@ bool Parser::parseExpression(ParseNode *parent)
 {
     bool res = true;
     ParseNode *node = nullptr;
+    auto mark = _arena.mark();
 
     // <Return> -> <Expression>
     do {
         auto tok = peek(0);
-        if (!tok) { res = false; break; }
+        if (!tok.isValid()) { res = false; break; }
 
-        node = new ParseNode(parent, tok, ParseNode::Expression);
+        node = _arena.create<ParseNode>(parent, tok, ParseNode::Expression);
         parent->setOperat(node);
 
         res = parseReturn(node);
@@ -389,7 +574,7 @@ bool Parser::parseExpression(ParseNode *parent)
 
     if (!res && node) {
         parent->removeChild(node);
-        delete node;
+        _arena.rollback(mark); // node and all below it
     }
 
     return res;
@@ -399,6 +584,7 @@ bool Parser::parseReturn(ParseNode *parent)
 {
     bool res = true;
     ParseNode *node = nullptr;
+    auto mark = _arena.mark();
 
     // < Return >
     do {
@@ -406,99 +592,150 @@ bool Parser::parseReturn(ParseNode *parent)
         res = failCheck(tok, LexToken::KwReturn);
         if (!res) break;
 
-        node = new ParseNode(parent, tok, ParseNode::Return);
+        node = _arena.create<ParseNode>(parent, tok, ParseNode::Return);
         parent->setOperat(node);
 
-        res = parseConstant(node);
+        res = parseOperators(node);
 
     } while(0);
 
     if (!res && node) {
         parent->removeChild(node);
-        delete node;
+        _arena.rollback(mark); // node and all below it
     }
 
     return res;
 }
 
-bool Parser::parseConstant(ParseNode *parent)
+bool Parser::parseOperators(ParseNode *parent)
 {
-     bool res = true;
-     ParseNode *node = nullptr;
-
-     // < IntLitteral | OctalLitteral | BinaryLitteral | HexLitteral | FloatLitteral >
-     do {
-         auto tok = nextTok();
-         res = failCheck(tok, LexToken::IntLitteral, false);
-         if (!res)
-             res = failCheck(tok, LexToken::OctalLitteral, false);
-         if (!res)
-             res = failCheck(tok, LexToken::BinaryLitteral, false);
-         if (!res)
-             res = failCheck(tok, LexToken::HexLitteral, false);
-         if (!res)
-             res = failCheck(tok, LexToken::FloatLitteral);
-         if (!res)
-             break;
-
-         node = new ParseNode(parent, tok, ParseNode::Constant);
-         parent->setOperat(node);
-
-     } while(0);
-
-     if (!res && node) {
-         parent->removeChild(node);
-         delete node;
-     }
-
-     return res;
-}
+    // precedence climbing without recursion, operands and pending
+    // operators live on two heap stacks so nesting depth is only
+    // limited by memory. Each token is shifted once and each node
+    // reduced once, linear in the length of the expression.
+    //
+    // < Unary* (Litteral | '(' Expr ')') > ( BinaryOp < ... > )*
+    struct PendingOp {
+        LexToken tok;    // Undefined for a '(' marker
+        uint8_t prec;
+        bool unary, rightAssoc;
+    };
+    vector<ParseNode*> operands;
+    vector<PendingOp> ops;
+    auto mark = _arena.mark();
+
+    // pop one operator and build its node from the operands
+    auto reduce = [&]() {
+        PendingOp op = ops.back();
+        ops.pop_back();
+        ParseNode *node;
+        if (op.unary) {
+            node = _arena.create<ParseNode>(nullptr, op.tok, ParseNode::UnaryOp);
+            node->setLeftOper(operands.back());
+        } else {
+            node = _arena.create<ParseNode>(nullptr, op.tok, ParseNode::BinaryOp);
+            node->setRightOper(operands.back());
+            operands.pop_back();
+            node->setLeftOper(operands.back());
+            node->rightOperand()->setParent(node);
+        }
+        node->leftOperand()->setParent(node);
+        operands.back() = node;
+    };
 
-LexToken *Parser::nextTok()
-{
-    while (_tokIt != _tokFile->end()) {
-        auto tok = &(*(_tokIt++));
-        if (tok->type != LexToken::Comment && tok->type != LexToken::NewLine)
-            return tok;
+    bool res = true, wantOperand = true;
+    for (;;) {
+        auto tok = peek(0);
+        if (wantOperand) {
+            if (opInfo(tok.type).unaryPrec) {
+                nextTok();
+                ops.push_back(PendingOp{ tok, opInfo(tok.type).unaryPrec, true, true });
+            } else if (tok.type == LexToken::OpenParen) {
+                nextTok();
+                ops.push_back(PendingOp{ LexToken(), 0, false, false });
+            } else {
+                nextTok();
+                // < IntLitteral | OctalLitteral | BinaryLitteral | HexLitteral >
+                // there is only int, a float has nothing to become
+                if (tok.type == LexToken::FloatLitteral) {
+                    _lexer->syntaxError(tok.pos, "Float litteral in an int expression");
+                    res = false;
+                    break;
+                }
+                res = tok.isInteger() || failCheck(tok, LexToken::IntLitteral);
+                if (!res) break;
+                operands.push_back(_arena.create<ParseNode>(nullptr, tok, ParseNode::Constant));
+                wantOperand = false;
+            }
+            continue;
+        }
+
+        const OpInfo &info = opInfo(tok.type);
+        if (info.binPrec) {
+            while (!ops.empty() && ops.back().tok.isValid() &&
+                   (ops.back().prec > info.binPrec ||
+                    (ops.back().prec == info.binPrec && !info.rightAssoc)))
+            {
+                reduce();
+            }
+            nextTok();
+            ops.push_back(PendingOp{ tok, info.binPrec, false, info.rightAssoc });
+            wantOperand = true;
+            continue;
+        }
+
+        // end of this (sub)expression
+        while (!ops.empty() && ops.back().tok.isValid())
+            reduce();
+        if (tok.type != LexToken::CloseParen || ops.empty())
+            break; // let the caller check what comes after
+        nextTok();
+        ops.pop_back(); // the '('
     }
 
-    return nullptr;
+    if (res && !ops.empty()) {
+        auto tok = peek(0);
+        res = failCheck(tok, LexToken::CloseParen); // unbalanced '('
+    }
+
+    if (!res) {
+        _arena.rollback(mark); // nothing is linked into parent yet
+        return false;
+    }
+
+    assert(operands.size() == 1);
+    operands.back()->setParent(parent);
+    parent->setOperat(operands.back());
+    return true;
 }
 
-LexToken *Parser::peek(int inc)
+LexToken Parser::nextTok()
 {
-    auto it = _tokIt;
-    while (it + inc != _tokFile->end()) {
-        auto tok = &(*(it + inc));
-        if (tok->type != LexToken::Comment && tok->type != LexToken::NewLine)
-            return tok;
-        else
-            ++it;
-    }
+    // comments and newlines are in the lexers trivia list, not here
+    return _cursor.next();
+}
 
-    return nullptr;
+LexToken Parser::peek(int inc)
+{
+    return _cursor.peek(static_cast<size_t>(inc));
 }
 
 
-bool Parser::failCheck(LexToken *tok, LexToken::Tokens type, bool print)
+bool Parser::failCheck(const LexToken &tok, LexToken::Tokens type, bool print)
 {
 
-    if (tok &&  tok->type == type)
+    if (tok.type == type)
         return true;
 
     if (print) {
-        if (!tok) {
-            cerr << "Failed parsing tok was not set from file " << _currentfile <<endl;
-            if (_tokIt != _tokFile->end())
-                tok = &_tokFile->back();
-        }
-        if (tok) {
-            cerr << "Failed parsing at " << tok->type_to_cstr()
-                 << " at line " << _lexer->lineForToken(*tok)
+        if (!tok.isValid()) {
+            _lexer->errorStream() << "Failed parsing tok was not set from file " << _currentfile <<endl;
+        } else {
+            _lexer->errorStream() << "Failed parsing at " << tok.type_to_cstr()
+                 << " at line " << _lexer->lineForToken(tok)
                  << endl;
-            _lexer->syntaxError(tok->pos);
+            _lexer->syntaxError(tok.pos);
         }
     }
     return false;
 }
-
@@ -2,6 +2,8 @@
 #define PARSER_H
 
 #include "lexer.h"
+#include "astarena.h"
+#include "symboltable.h"
 #include <sstream>
 
 namespace Cmp {
@@ -13,6 +15,7 @@ class ParseNode
 public:
     enum Kind { Undefined, Program, Function, Statement, Return,
                 Expression, Constant, DataType,
+                BinaryOp, UnaryOp, // operator in the token, unary has its operand left
                 EndMarker
               };
 private:
@@ -20,14 +23,14 @@ private:
             *_leftOperand,
             *_rightOperand,
             *_operator;
-    LexToken *_tok;
+    LexToken _tok;
     Kind _kind;
 public:
-   explicit ParseNode(ParseNode *parent, LexToken *tok, Kind type);
-   ~ParseNode();
+   // allocated in the parsers AstArena, never deleted on its own
+   explicit ParseNode(ParseNode *parent, const LexToken &tok, Kind type);
 
     Kind kind() const { return _kind; }
-    LexToken *lexToken() const { return _tok; }
+    const LexToken *lexToken() const { return _tok.isValid() ? &_tok : nullptr; }
     ParseNode *parent() const { return _parent; }
     ParseNode *leftOperand() const { return _leftOperand; }
     ParseNode *rightOperand() const { return _rightOperand; }
@@ -38,30 +41,99 @@ public:
     void setParent(ParseNode *parent);
     void removeChild(ParseNode *child);
 
-    const char* to_cstr() const;
+    const char* to_cstr() const { return kind_to_cstr(_kind); }
+    static const char *kind_to_cstr(Kind kind);
 
 };
 
 // ---------------------------------------------------------------------
 
+// the AST as one contiguous array in pre-order (node, left, operat, right),
+// children and the token are 32bit indexes, the tokens sit in a compact
+// TokenList. Built from the ParseNode tree when
+// parsing is done, this is what the later stages walk.
+class FlatAst
+{
+public:
+    typedef uint32_t NodeIdx;
+    static const NodeIdx NoNode = 0xFFFFFFFF;
+    static const uint32_t NoTok = 0xFFFFFFFF;
+
+    struct Node {
+        uint32_t kind; // ParseNode::Kind in the low 7 bits, Folded
+        uint32_t tok;  // index in the TokenList
+        NodeIdx left, operat, right;
+    };
+    static const uint32_t Folded = 0x80; // rewritten by ConstantFolder
+
+    explicit FlatAst();
+
+    // srcBase is the start of the source the tokens point into
+    bool build(const ParseNode *root, const char *srcBase);
+    void clear();
+
+    bool empty() const { return _nodes.empty(); }
+    size_t size() const { return _nodes.size(); }
+    NodeIdx root() const { return _nodes.empty() ? NoNode : 0; }
+    const Node &node(NodeIdx i) const { return _nodes[i]; }
+
+    ParseNode::Kind kind(NodeIdx i) const { return static_cast<ParseNode::Kind>(_nodes[i].kind & 0x7F); }
+    bool folded(NodeIdx i) const { return (_nodes[i].kind & Folded) != 0; }
+    bool hasToken(NodeIdx i) const { return _nodes[i].tok != NoTok; }
+    LexToken token(NodeIdx i) const { return hasToken(i) ? _tokens.at(_nodes[i].tok) : LexToken(); }
+    // without building the whole LexToken
+    LexToken::Tokens tokenType(NodeIdx i) const {
+        return hasToken(i) ? _tokens.type(_nodes[i].tok) : LexToken::Undefined;
+    }
+    NodeIdx left(NodeIdx i) const { return _nodes[i].left; }
+    NodeIdx operat(NodeIdx i) const { return _nodes[i].operat; }
+    NodeIdx right(NodeIdx i) const { return _nodes[i].right; }
+
+    // rewrites for the folding pass, the old children stay in the array
+    // but nothing points to them anymore.
+    // i becomes an int constant, false if there is no room for its token
+    bool setConstant(NodeIdx i, uint32_t value);
+    // i becomes a copy of its descendant with, keeps its own operat
+    void replace(NodeIdx i, NodeIdx with);
+
+private:
+    std::vector<Node> _nodes;
+    TokenList _tokens;
+};
+
+// ---------------------------------------------------------------------
+
 class Parser
 {
+    AstArena _arena; // owns all ParseNodes
     ParseNode *_root;
+    FlatAst _flat;   // _root flattened after a successful parse
+    const char *_srcBase;
     Lexer *_lexer;
    // size_t _curTokIdx;
     const char* _currentfile;
-    Lexer::T_Tokens *_tokFile;
-    Lexer::T_Tokens::iterator _tokIt;
+    TokenCursor _cursor; // over the lexers store or a lexer stream
+    SymbolTable _symbols;
+    // node numbering for to_dot
+    mutable std::map<std::string, int> _dotNodeNrs;
+    mutable uint _dotEmptyNr;
 public:
     explicit Parser(Lexer* lexer, const char* currentfile);
     ~Parser();
     ParseNode *root() const { return _root; }
+    const FlatAst &ast() const { return _flat; }
+    FlatAst &ast() { return _flat; }
+    // global scope is left when parsing is done
+    const SymbolTable &symbols() const { return _symbols; }
 
     bool parse(const char *srcStr = nullptr, const char* otherfile = nullptr);
+    // lex and parse in one go, tokens are pulled from the lexer as needed
+    // and never stored for the whole file
+    bool parseStream(const char *srcStr, const char *filename);
 
     std::string to_string() const;
 
-    std::string to_dot(ParseNode *root) const; // graphviz dot code
+    std::string to_dot() const; // graphviz dot code
 
     bool isValid() const { return _root != nullptr; }
 
@@ -72,16 +144,18 @@ private:
     bool parseStatement(ParseNode *parent);
     bool parseExpression(ParseNode *parent);
     bool parseReturn(ParseNode *parent);
-    bool parseConstant(ParseNode *parent);
+    bool parseOperators(ParseNode *parent);
+
+    LexToken nextTok();
+    LexToken peek(int inc = 1);
 
-    LexToken *nextTok();
-    LexToken *peek(int inc = 1);
+    bool failCheck(const LexToken &tok, LexToken::Tokens type, bool print = true);
 
-    bool failCheck(LexToken *tok, LexToken::Tokens type, bool print = true);
+    bool flatten();
 
-    void recursePrint(ParseNode *node, std::stringstream &res,
-                      size_t leftDepth, size_t longestname) const;
-    void recurseDot(std::stringstream &dot, ParseNode *n, std::string parentName) const;
+    void printTree(FlatAst::NodeIdx node, std::stringstream &res,
+                   size_t leftDepth, size_t longestname) const;
+    void dotTree(std::stringstream &dot, FlatAst::NodeIdx n) const;
     void emptyDot(std::stringstream &dot, std::string parentName) const;
 };
 
@@ -0,0 +1,153 @@
+#include "peephole.h"
+#include <string>
+#include <iomanip>
+
+using namespace Cmp;
+using namespace std;
+
+namespace {
+
+// removed instructions become Comment with no text until compact()
+const Inst::Op Removed = Inst::Comment;
+
+inline void removeInst(Inst &inst)
+{
+    inst.op = Removed;
+    inst.text = nullptr;
+    inst.textLen = 0;
+}
+
+inline bool isRemoved(const Inst &inst)
+{
+    return inst.op == Removed && inst.text == nullptr;
+}
+
+// not code, windows look past these
+inline bool isNote(const Inst &inst)
+{
+    return inst.op == Inst::Comment || inst.op == Inst::Directive;
+}
+
+inline bool isCode(const Inst &inst)
+{
+    return !isNote(inst) && inst.op != Inst::Label;
+}
+
+inline bool uses(const Operand &o, Reg r)
+{
+    return (o.kind == Operand::Register || o.kind == Operand::Mem) && o.reg == r;
+}
+
+// does the instruction read r (as a value or an address)
+bool reads(const Inst &inst, Reg r)
+{
+    switch (inst.op) {
+    case Inst::Cdq:
+        return r == Eax;
+    case Inst::Idiv:
+        return r == Eax || r == Edx || uses(inst.dst, r);
+    case Inst::Mov: case Inst::Movzb: case Inst::Setcc: case Inst::Pop:
+        // dst only written, unless it is an address
+        return uses(inst.src, r) || (inst.dst.kind == Operand::Mem && inst.dst.reg == r);
+    case Inst::Shl: case Inst::Sar:
+        return uses(inst.dst, r) || uses(inst.src, r);
+    case Inst::Ret:
+        return r == Eax || r == Esp;
+    case Inst::Label: case Inst::Comment: case Inst::Directive:
+        return false;
+    default:
+        return uses(inst.dst, r) || uses(inst.src, r);
+    }
+}
+
+} // namespace
+
+Peephole::Peephole()
+{ }
+
+size_t Peephole::run(InstList &code)
+{
+    _stats = count(code);
+    vector<Inst> &insts = code.instructions();
+
+    size_t total = 0, changes;
+    do {
+        changes = 0;
+        for (size_t i = 0; i < insts.size(); ++i) {
+            if (isRemoved(insts[i]))
+                continue;
+            if (insts[i].op == Inst::Mov && deadMove(insts, i))
+                ++changes;
+        }
+        compact(insts);
+        total += changes;
+    } while (changes);
+
+    auto after = count(code);
+    for (size_t i = 0; i < _stats.size() && i < after.size(); ++i)
+        _stats[i].after = after[i].before;
+    return total;
+}
+
+// movl X, R followed by something that sets R without reading it
+bool Peephole::deadMove(vector<Inst> &insts, size_t idx)
+{
+    Inst &mov = insts[idx];
+    if (mov.dst.kind != Operand::Register)
+        return false;
+    if (mov.src.isReg(mov.dst.reg)) {
+        removeInst(mov);
+        return true;
+    }
+    if (mov.dst.reg == Esp || mov.dst.reg == Ebp)
+        return false;
+
+    for (size_t i = idx + 1; i < insts.size(); ++i) {
+        const Inst &inst = insts[i];
+        if (isRemoved(inst) || isNote(inst))
+            continue;
+        if (inst.op == Inst::Label || reads(inst, mov.dst.reg))
+            return false;
+        if ((inst.op == Inst::Mov || inst.op == Inst::Pop) && inst.dst.isReg(mov.dst.reg)) {
+            removeInst(mov);
+            return true;
+        }
+        return false; // only look at the next instruction
+    }
+    return false;
+}
+
+void Peephole::compact(vector<Inst> &insts)
+{
+    size_t out = 0;
+    for (size_t i = 0; i < insts.size(); ++i) {
+        if (!isRemoved(insts[i]))
+            insts[out++] = insts[i];
+    }
+    insts.resize(out);
+}
+
+vector<Peephole::FunctionStats> Peephole::count(const InstList &code)
+{
+    vector<FunctionStats> res;
+    for (const Inst &inst : code) {
+        if (inst.op == Inst::Label &&
+            code.labelInfo(static_cast<InstList::LabelId>(inst.dst.value)).function)
+        {
+            res.push_back(FunctionStats{ static_cast<InstList::LabelId>(inst.dst.value), 0, 0 });
+        } else if (isCode(inst) && !res.empty())
+            ++res.back().before;
+    }
+    return res;
+}
+
+void Peephole::report(const InstList &code, ostream &out) const
+{
+    out << left << setw(24) << "function" << right << setw(8) << "before"
+        << setw(8) << "after" << "\n";
+    for (const FunctionStats &s : _stats) {
+        const InstList::LabelInfo &l = code.labelInfo(s.label);
+        out << left << setw(24) << string(l.name, l.len) << right
+            << setw(8) << s.before << setw(8) << s.after << "\n";
+    }
+}
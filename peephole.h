@@ -0,0 +1,45 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <inttypes.h>
+#include <vector>
+#include <ostream>
+#include "instlist.h"
+
+namespace Cmp {
+
+// small rewrites on the InstList between the generator and the encoder:
+//  movl R, R                   -> gone
+//  movl X, R; movl Y, R        -> movl Y, R  (first one is dead)
+// Labels end a window, comments and directives are skipped over.
+// Temporaries live in registers since RegAlloc, the generator has no
+// push/pop pairs left to fold and the frame is its call too.
+class Peephole
+{
+public:
+    struct FunctionStats {
+        InstList::LabelId label;
+        size_t before, after; // real instructions, no labels or comments
+    };
+
+    explicit Peephole();
+
+    // rewrites until nothing changes, returns number of rewrites
+    size_t run(InstList &code);
+
+    const std::vector<FunctionStats> &stats() const { return _stats; }
+    // one line per function, instruction count before and after
+    void report(const InstList &code, std::ostream &out) const;
+
+private:
+    bool deadMove(std::vector<Inst> &insts, size_t idx);
+    void compact(std::vector<Inst> &insts);
+
+    static std::vector<FunctionStats> count(const InstList &code);
+
+    std::vector<FunctionStats> _stats;
+};
+
+} // namespace Cmp
+
+#endif // PEEPHOLE_H
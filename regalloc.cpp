@@ -0,0 +1,348 @@
+#include "regalloc.h"
+
+using namespace Cmp;
+using namespace std;
+
+namespace {
+
+inline Operand reg(Reg r) { return Operand::makeReg(r); }
+
+inline Inst makeInst(Inst::Op op, Operand dst, Operand src = Operand::makeNone())
+{
+    Inst inst = { op, CondE, dst, src, nullptr, 0 };
+    return inst;
+}
+
+inline uint16_t regBit(Reg r) { return static_cast<uint16_t>(1 << r); }
+
+inline uint16_t regBit(const Operand &o)
+{
+    return o.kind == Operand::Register || o.kind == Operand::Mem ? regBit(o.reg) : 0;
+}
+
+// physical registers an instruction names, or uses without naming them
+uint16_t fixedRegs(const Inst &inst, uint16_t callClobbers)
+{
+    uint16_t mask = regBit(inst.dst) | regBit(inst.src);
+    switch (inst.op) {
+    case Inst::Cdq: case Inst::Idiv:
+        return mask | regBit(Eax) | regBit(Edx);
+    case Inst::Call:
+        return mask | callClobbers;
+    case Inst::Ret:
+        return mask | regBit(Eax);
+    default:
+        return mask;
+    }
+}
+
+// movl %eax, v / movl v, %eax / movzbl %al, v don't mind v in %eax
+bool coalesces(const Inst &inst, uint32_t nr, Reg r)
+{
+    if (inst.op == Inst::Mov)
+        return (inst.dst.isVirtual(nr) && inst.src.isReg(r)) ||
+               (inst.src.isVirtual(nr) && inst.dst.isReg(r));
+    return inst.op == Inst::Movzb && inst.dst.isVirtual(nr) && inst.src.isReg(r);
+}
+
+bool isFunction(const InstList &code, const Inst &inst)
+{
+    return inst.op == Inst::Label &&
+           code.labelInfo(static_cast<InstList::LabelId>(inst.dst.value)).function;
+}
+
+// the generator set up %ebp, movl %esp, %ebp is in the prolog
+bool hasFrame(const InstList &code, size_t begin, size_t end)
+{
+    for (size_t p = begin; p < end; ++p) {
+        const Inst &inst = code[p];
+        if (inst.op == Inst::Mov && inst.dst.isReg(Ebp) && inst.src.isReg(Esp))
+            return true;
+    }
+    return false;
+}
+
+// a call would write its return address over the red zone
+bool calls(const InstList &code, size_t begin, size_t end)
+{
+    for (size_t p = begin; p < end; ++p) {
+        if (code[p].op == Inst::Call)
+            return true;
+    }
+    return false;
+}
+
+// handed out in this order, caller saved first so small functions
+// have nothing to save
+const Reg _pool32[] = { Eax, Ecx, Ebx, Esi, Edi };
+const Reg _calleeSaved32[] = { Ebx, Esi, Edi };
+// SysV x86-64, %esi and %edi are caller saved there
+const Reg _pool64[] = { Eax, Ecx, Esi, Edi, R8, R9, R10, R11, Ebx, R12, R13, R14, R15 };
+const Reg _calleeSaved64[] = { Ebx, R12, R13, R14, R15 };
+
+// bytes below %rsp a leaf function may use without moving it
+const int32_t _redZone = 128;
+
+} // namespace
+
+struct RegAlloc::Registers {
+    const Reg *pool;
+    size_t poolCount;
+    const Reg *calleeSaved;
+    size_t calleeSavedCount;
+    uint16_t callClobbers; // besides the arguments
+    bool redZone;
+};
+
+namespace {
+
+#define COUNT(a) sizeof(a) / sizeof(a[0])
+const RegAlloc::Registers _i386 = {
+    _pool32, COUNT(_pool32), _calleeSaved32, COUNT(_calleeSaved32),
+    1 << Eax | 1 << Ecx | 1 << Edx, false
+};
+const RegAlloc::Registers _x86_64 = {
+    _pool64, COUNT(_pool64), _calleeSaved64, COUNT(_calleeSaved64),
+    1 << Eax | 1 << Ecx | 1 << Edx | 1 << Esi | 1 << Edi |
+    1 << R8 | 1 << R9 | 1 << R10 | 1 << R11, true
+};
+#undef COUNT
+
+} // namespace
+
+RegAlloc::RegAlloc(ostream &err, bool stackOnly)
+    : _err(err)
+    , _regs(&_i386)
+    , _slots(0)
+    , _spills(0)
+    , _stackOnly(stackOnly)
+{ }
+
+bool RegAlloc::run(InstList &code)
+{
+    _spills = 0;
+    if (!code.virtualCount())
+        return true;
+    _regs = code.target() == TargetX86_64 ? &_x86_64 : &_i386;
+    _where.assign(code.virtualCount(), -1);
+
+    // functions are rebuilt into out, saves and scratch moves make them grow
+    vector<Inst> out;
+    out.reserve(code.size() + code.size() / 4);
+    bool res = true;
+    for (size_t i = 0; i < code.size();) {
+        if (!isFunction(code, code[i])) {
+            out.push_back(code[i++]);
+            continue;
+        }
+        size_t end = i + 1;
+        while (end < code.size() && !isFunction(code, code[end]))
+            ++end;
+        res = function(code, i, end, out) && res;
+        i = end;
+    }
+    code.instructions().swap(out);
+    return res;
+}
+
+bool RegAlloc::function(const InstList &code, size_t begin, size_t end, vector<Inst> &out)
+{
+    vector<Interval> intervals;
+    scan(code, begin, end, intervals);
+
+    _slots = 0;
+    vector<size_t> active; // intervals holding a register
+    bool busy[16] = { false };
+    uint16_t used = 0;
+    for (size_t i = 0; i < intervals.size(); ++i) {
+        Interval &iv = intervals[i];
+        if (_stackOnly) {
+            spill(iv);
+            continue;
+        }
+        // ranges that ended give their register back
+        for (size_t a = 0; a < active.size();) {
+            if (intervals[active[a]].end < iv.start) {
+                busy[intervals[active[a]].reg] = false;
+                active[a] = active.back();
+                active.pop_back();
+            } else
+                ++a;
+        }
+
+        // movl u, iv as the last use of u, iv takes over its register
+        const Inst &first = code[iv.start];
+        if (first.op == Inst::Mov && first.dst.isVirtual(iv.nr) && first.src.kind == Operand::Virtual) {
+            for (size_t a = 0; a < active.size(); ++a) {
+                const Interval &u = intervals[active[a]];
+                if (first.src.isVirtual(u.nr) && u.end == iv.start && !blocked(code, begin, iv, u.reg)) {
+                    iv.reg = u.reg;
+                    active[a] = i;
+                    break;
+                }
+            }
+            if (iv.reg != NoReg)
+                continue;
+        }
+
+        for (size_t p = 0; p < _regs->poolCount; ++p) {
+            Reg r = _regs->pool[p];
+            if (!busy[r] && !blocked(code, begin, iv, r)) {
+                iv.reg = r;
+                break;
+            }
+        }
+        if (iv.reg != NoReg) {
+            active.push_back(i);
+        } else {
+            // out of registers, whoever lives longest goes to the stack
+            size_t victim = active.size();
+            for (size_t a = 0; a < active.size(); ++a) {
+                const Interval &other = intervals[active[a]];
+                if (other.end > iv.end && !blocked(code, begin, iv, other.reg) &&
+                    (victim == active.size() || other.end > intervals[active[victim]].end))
+                {
+                    victim = a;
+                }
+            }
+            if (victim == active.size()) {
+                spill(iv);
+                continue;
+            }
+            Interval &other = intervals[active[victim]];
+            iv.reg = other.reg;
+            spill(other);
+            active[victim] = i;
+        }
+        busy[iv.reg] = true;
+        used |= regBit(iv.reg);
+    }
+
+    // slots sit below %ebp when the function has a frame, else they are
+    // addressed off %esp: in the red zone below it, or above it in space
+    // made after the saves
+    bool frame = hasFrame(code, begin, end);
+    bool redZone = _regs->redZone && 4 * _slots <= _redZone && !calls(code, begin, end);
+    bool reserve = _slots > 0 && !redZone; // moves %esp for the slots
+    auto location = [&](const Operand &o) {
+        if (o.kind != Operand::Virtual)
+            return o;
+        const Interval &iv = intervals[static_cast<size_t>(_where[static_cast<size_t>(o.value)])];
+        if (iv.reg != NoReg)
+            return reg(iv.reg);
+        if (frame)
+            return Operand::makeMem(Ebp, -4 * (iv.slot + 1));
+        return redZone ? Operand::makeMem(Esp, -4 * (iv.slot + 1)) : Operand::makeMem(Esp, 4 * iv.slot);
+    };
+
+    // saves go before the frame, so the slots sit right below %ebp
+    out.push_back(code[begin]);
+    for (size_t s = 0; s < _regs->calleeSavedCount; ++s) {
+        if (used & regBit(_regs->calleeSaved[s]))
+            out.push_back(makeInst(Inst::Push, reg(_regs->calleeSaved[s])));
+    }
+    if (reserve && !frame)
+        out.push_back(makeInst(Inst::Sub, reg(Esp), Operand::makeImm(4 * _slots)));
+    for (size_t p = begin + 1; p < end; ++p) {
+        Inst inst = code[p];
+        if (inst.op == Inst::Ret) {
+            // the epilog has put %esp back when there is a frame
+            if (reserve && !frame)
+                out.push_back(makeInst(Inst::Add, reg(Esp), Operand::makeImm(4 * _slots)));
+            for (size_t s = _regs->calleeSavedCount; s-- > 0;) {
+                if (used & regBit(_regs->calleeSaved[s]))
+                    out.push_back(makeInst(Inst::Pop, reg(_regs->calleeSaved[s])));
+            }
+        }
+        inst.dst = location(inst.dst);
+        inst.src = location(inst.src);
+        legalize(inst, out);
+
+        if (reserve && frame && inst.op == Inst::Mov && inst.dst.isReg(Ebp) && inst.src.isReg(Esp))
+            out.push_back(makeInst(Inst::Sub, reg(Esp), Operand::makeImm(4 * _slots)));
+    }
+    return true;
+}
+
+// live ranges in order of their start, and the named registers of each
+// instruction in the function
+void RegAlloc::scan(const InstList &code, size_t begin, size_t end, vector<Interval> &intervals)
+{
+    size_t n = end - begin;
+    _fixed.assign(n, 0);
+    for (auto &before : _fixedBefore)
+        before.assign(n + 1, 0);
+
+    for (size_t p = begin; p < end; ++p) {
+        const Inst &inst = code[p];
+        size_t k = p - begin;
+        _fixed[k] = fixedRegs(inst, _regs->callClobbers);
+        for (size_t r = 0; r < 16; ++r)
+            _fixedBefore[r][k + 1] = _fixedBefore[r][k] + (_fixed[k] >> r & 1);
+
+        const Operand *ops[] = { &inst.dst, &inst.src };
+        for (const Operand *o : ops) {
+            if (o->kind != Operand::Virtual)
+                continue;
+            int32_t &w = _where[static_cast<size_t>(o->value)];
+            if (w < 0) {
+                w = static_cast<int32_t>(intervals.size());
+                intervals.push_back(Interval{ static_cast<uint32_t>(o->value), p, p, NoReg, -1 });
+            } else
+                intervals[static_cast<size_t>(w)].end = p;
+        }
+    }
+}
+
+// may iv live in r, named registers block it for the whole range
+bool RegAlloc::blocked(const InstList &code, size_t begin, const Interval &iv, Reg r) const
+{
+    const vector<uint32_t> &before = _fixedBefore[r];
+    size_t s = iv.start - begin, e = iv.end - begin;
+    if (e > s && before[e] - before[s + 1])
+        return true;
+    // at the ends a move to or from r itself is fine
+    return ((_fixed[s] >> r & 1) && !coalesces(code[iv.start], iv.nr, r)) ||
+           ((_fixed[e] >> r & 1) && !coalesces(code[iv.end], iv.nr, r));
+}
+
+void RegAlloc::spill(Interval &iv)
+{
+    iv.reg = NoReg;
+    iv.slot = _slots++;
+    ++_spills;
+}
+
+// x86 has no memory to memory forms and imul/movzbl only write
+// registers, go through %edx for those
+void RegAlloc::legalize(const Inst &inst, vector<Inst> &out)
+{
+    const Operand scratch = reg(Edx);
+    bool dstMem = inst.dst.kind == Operand::Mem,
+         srcMem = inst.src.kind == Operand::Mem;
+    switch (inst.op) {
+    case Inst::Imul: case Inst::Movzb:
+        if (dstMem) {
+            Inst viaReg = inst;
+            viaReg.dst = scratch;
+            if (inst.op == Inst::Imul)
+                out.push_back(makeInst(Inst::Mov, scratch, inst.dst));
+            out.push_back(viaReg);
+            out.push_back(makeInst(Inst::Mov, inst.dst, scratch));
+            return;
+        }
+        break;
+    case Inst::Mov: case Inst::Add: case Inst::Sub: case Inst::And:
+    case Inst::Or: case Inst::Xor: case Inst::Cmp:
+        if (dstMem && srcMem) {
+            Inst viaReg = inst;
+            viaReg.src = scratch;
+            out.push_back(makeInst(Inst::Mov, scratch, inst.src));
+            out.push_back(viaReg);
+            return;
+        }
+        break;
+    default: ;
+    }
+    out.push_back(inst);
+}
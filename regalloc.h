@@ -0,0 +1,70 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include <inttypes.h>
+#include <vector>
+#include <ostream>
+#include "instlist.h"
+
+namespace Cmp {
+
+// linear scan over the virtual registers the generator keeps its
+// expression temporaries in. Each one gets a register for its whole
+// live range or, when they run out, a stack slot.
+// Live ranges go from first to last mention in list order, good as long
+// as the generator only jumps forward (no loops yet).
+// Registers named in the code (%eax for idiv, %ecx for shifts...) are
+// not handed out across those instructions, the generator only keeps a
+// value in them from one instruction to the next. %edx is never handed out,
+// it is the scratch register when both operands are in memory.
+// A movl from a register that dies there hands that register on.
+// Used callee saved registers are pushed before the frame is set up and
+// popped before each ret.
+// Functions the generator left without a frame address their slots off
+// %esp, the generator never pushes inside a function body so it stays put.
+// Which registers there are and who saves them comes from the target of
+// the InstList, x86-64 has %r8-%r15 too and the SysV leaf functions keep
+// their spills in the red zone below %rsp without moving it.
+class RegAlloc
+{
+public:
+    struct Registers; // what a target has, in regalloc.cpp
+
+    // stackOnly gives every temporary a stack slot, the code from before
+    // there was an allocator, to compare against
+    explicit RegAlloc(std::ostream &err, bool stackOnly = false);
+
+    // replaces every virtual register in code, false on error
+    bool run(InstList &code);
+
+    size_t spills() const { return _spills; } // in the last run
+
+private:
+    struct Interval {
+        uint32_t nr;       // virtual register
+        size_t start, end; // first and last instruction that mentions it
+        Reg reg;           // NoReg when spilled
+        int32_t slot;      // stack slot, -1 when in reg
+    };
+
+    bool function(const InstList &code, size_t begin, size_t end, std::vector<Inst> &out);
+    void scan(const InstList &code, size_t begin, size_t end, std::vector<Interval> &intervals);
+    bool blocked(const InstList &code, size_t begin, const Interval &iv, Reg r) const;
+    void spill(Interval &iv);
+    static void legalize(const Inst &inst, std::vector<Inst> &out);
+
+    std::ostream &_err;
+    std::vector<int32_t> _where; // interval of each virtual register
+    // per function: registers each instruction names, and how many
+    // instructions before position i name each register
+    std::vector<uint16_t> _fixed;
+    std::vector<uint32_t> _fixedBefore[16];
+    const Registers *_regs;
+    int32_t _slots;
+    size_t _spills;
+    bool _stackOnly;
+};
+
+} // namespace Cmp
+
+#endif // REGALLOC_H
@@ -0,0 +1,258 @@
+#include "simdscan.h"
+#include <cstdint>
+#include <atomic>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define CMP_SIMD_X86 1
+# include <immintrin.h>
+#endif
+
+using namespace Cmp;
+
+namespace {
+
+struct Kernels {
+    SimdScan::Level level;
+    const char *(*skipBlanks)(const char *p);
+    const char *(*findLineEnd)(const char *p);
+    const char *(*findStar)(const char *p);
+    const char *(*findQuoteEnd)(const char *p, char quote);
+};
+
+// --------------------------------------------------------------------
+// scalar, reference for the others
+
+inline bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+const char *skipBlanksScalar(const char *p)
+{
+    while (isBlank(*p))
+        ++p;
+    return p;
+}
+
+const char *findLineEndScalar(const char *p)
+{
+    while (*p != 0 && *p != '\n')
+        ++p;
+    return p;
+}
+
+const char *findStarScalar(const char *p)
+{
+    while (*p != 0 && *p != '*' && *p != '\n')
+        ++p;
+    return p;
+}
+
+const char *findQuoteEndScalar(const char *p, char quote)
+{
+    while (*p != 0 && *p != quote && *p != '\\' && *p != '\n')
+        ++p;
+    return p;
+}
+
+const Kernels scalarKernels = {
+    SimdScan::Scalar, skipBlanksScalar, findLineEndScalar, findStarScalar, findQuoteEndScalar
+};
+
+#ifdef CMP_SIMD_X86
+
+// Loads are aligned to the vector width, so a load never crosses into
+// the next page even when the terminator sits at the end of a mapping.
+// Bits for bytes in front of p are shifted out of the first mask.
+
+// --------------------------------------------------------------------
+// SSE2, 16 bytes per step
+
+__attribute__((target("sse2")))
+inline unsigned blankMask16(__m128i v)
+{
+    // ' ' or 9..13 except '\n'
+    const __m128i off = _mm_sub_epi8(v, _mm_set1_epi8(9));
+    const __m128i inRange = _mm_cmpeq_epi8(_mm_min_epu8(off, _mm_set1_epi8(4)), off);
+    const __m128i nl = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+    const __m128i sp = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    return static_cast<unsigned>(_mm_movemask_epi8(
+                _mm_or_si128(sp, _mm_andnot_si128(nl, inRange))));
+}
+
+template<char A, char B, char C>
+__attribute__((target("sse2")))
+inline unsigned stopMask16(__m128i v, char quote)
+{
+    __m128i m = _mm_cmpeq_epi8(v, _mm_setzero_si128());
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(A)));
+    if (B) m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(B)));
+    if (C) m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(C)));
+    if (quote) m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(quote)));
+    return static_cast<unsigned>(_mm_movemask_epi8(m));
+}
+
+template<bool Invert, char A, char B, char C>
+__attribute__((target("sse2")))
+const char *scan16(const char *p, char quote)
+{
+    const unsigned mis = reinterpret_cast<uintptr_t>(p) & 15;
+    const __m128i *ap = reinterpret_cast<const __m128i*>(p - mis);
+    for (unsigned skip = mis;; skip = 0, ++ap) {
+        __m128i v = _mm_load_si128(ap);
+        unsigned mask = Invert ? (~blankMask16(v) & 0xFFFFu)
+                               : stopMask16<A, B, C>(v, quote);
+        mask = (mask >> skip) << skip;
+        if (mask)
+            return reinterpret_cast<const char*>(ap) + __builtin_ctz(mask);
+    }
+}
+
+const char *skipBlanksSse2(const char *p) { return scan16<true, 0, 0, 0>(p, 0); }
+const char *findLineEndSse2(const char *p) { return scan16<false, '\n', 0, 0>(p, 0); }
+const char *findStarSse2(const char *p) { return scan16<false, '*', '\n', 0>(p, 0); }
+const char *findQuoteEndSse2(const char *p, char quote)
+{
+    return scan16<false, '\\', '\n', 0>(p, quote);
+}
+
+const Kernels sse2Kernels = {
+    SimdScan::Sse2, skipBlanksSse2, findLineEndSse2, findStarSse2, findQuoteEndSse2
+};
+
+// --------------------------------------------------------------------
+// AVX2, 32 bytes per step
+
+__attribute__((target("avx2")))
+inline unsigned blankMask32(__m256i v)
+{
+    const __m256i off = _mm256_sub_epi8(v, _mm256_set1_epi8(9));
+    const __m256i inRange = _mm256_cmpeq_epi8(_mm256_min_epu8(off, _mm256_set1_epi8(4)), off);
+    const __m256i nl = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+    const __m256i sp = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    return static_cast<unsigned>(_mm256_movemask_epi8(
+                _mm256_or_si256(sp, _mm256_andnot_si256(nl, inRange))));
+}
+
+template<char A, char B, char C>
+__attribute__((target("avx2")))
+inline unsigned stopMask32(__m256i v, char quote)
+{
+    __m256i m = _mm256_cmpeq_epi8(v, _mm256_setzero_si256());
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(A)));
+    if (B) m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(B)));
+    if (C) m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(C)));
+    if (quote) m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(quote)));
+    return static_cast<unsigned>(_mm256_movemask_epi8(m));
+}
+
+template<bool Invert, char A, char B, char C>
+__attribute__((target("avx2")))
+const char *scan32(const char *p, char quote)
+{
+    const unsigned mis = reinterpret_cast<uintptr_t>(p) & 31;
+    const __m256i *ap = reinterpret_cast<const __m256i*>(p - mis);
+    for (unsigned skip = mis;; skip = 0, ++ap) {
+        __m256i v = _mm256_load_si256(ap);
+        unsigned mask = Invert ? ~blankMask32(v) : stopMask32<A, B, C>(v, quote);
+        mask = (mask >> skip) << skip;
+        if (mask)
+            return reinterpret_cast<const char*>(ap) + __builtin_ctz(mask);
+    }
+}
+
+const char *skipBlanksAvx2(const char *p) { return scan32<true, 0, 0, 0>(p, 0); }
+const char *findLineEndAvx2(const char *p) { return scan32<false, '\n', 0, 0>(p, 0); }
+const char *findStarAvx2(const char *p) { return scan32<false, '*', '\n', 0>(p, 0); }
+const char *findQuoteEndAvx2(const char *p, char quote)
+{
+    return scan32<false, '\\', '\n', 0>(p, quote);
+}
+
+const Kernels avx2Kernels = {
+    SimdScan::Avx2, skipBlanksAvx2, findLineEndAvx2, findStarAvx2, findQuoteEndAvx2
+};
+
+#endif // CMP_SIMD_X86
+
+// --------------------------------------------------------------------
+
+SimdScan::Level detectLevel()
+{
+#ifdef CMP_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return SimdScan::Avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return SimdScan::Sse2;
+#endif
+    return SimdScan::Scalar;
+}
+
+const Kernels *kernelsFor(SimdScan::Level lvl)
+{
+    switch (lvl) {
+#ifdef CMP_SIMD_X86
+    case SimdScan::Avx2: return &avx2Kernels;
+    case SimdScan::Sse2: return &sse2Kernels;
+#endif
+    default: return &scalarKernels;
+    }
+}
+
+// the kernels are swapped as one pointer, -j workers may be lexing
+// while a level is forced
+struct Selected {
+    SimdScan::Level detected;
+    std::atomic<const Kernels*> k;
+    Selected() : detected(detectLevel()), k(kernelsFor(detected)) {}
+};
+
+Selected &selected()
+{
+    static Selected sel;
+    return sel;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------
+
+SimdScan::Level SimdScan::detected()
+{
+    return selected().detected;
+}
+
+SimdScan::Level SimdScan::level()
+{
+    return selected().k.load(std::memory_order_relaxed)->level;
+}
+
+SimdScan::Level SimdScan::setLevel(SimdScan::Level lvl)
+{
+    Selected &sel = selected();
+    if (lvl > sel.detected)
+        lvl = sel.detected;
+    sel.k.store(kernelsFor(lvl), std::memory_order_relaxed);
+    return lvl;
+}
+
+const char *SimdScan::skipBlanks(const char *p)
+{
+    return selected().k.load(std::memory_order_relaxed)->skipBlanks(p);
+}
+
+const char *SimdScan::findLineEnd(const char *p)
+{
+    return selected().k.load(std::memory_order_relaxed)->findLineEnd(p);
+}
+
+const char *SimdScan::findStar(const char *p)
+{
+    return selected().k.load(std::memory_order_relaxed)->findStar(p);
+}
+
+const char *SimdScan::findQuoteEnd(const char *p, char quote)
+{
+    return selected().k.load(std::memory_order_relaxed)->findQuoteEnd(p, quote);
+}
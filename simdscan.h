@@ -0,0 +1,33 @@
+#ifndef SIMDSCAN_H
+#define SIMDSCAN_H
+
+namespace Cmp {
+
+// bulk scanning kernels for the lexer, picks SSE2/AVX2 at runtime
+// when the cpu supports it, falls back to plain byte loops otherwise.
+// All kernels stop at the NUL terminator, they never look past the
+// aligned block that holds it.
+class SimdScan
+{
+public:
+    enum Level { Scalar, Sse2, Avx2 };
+
+    // best level this cpu supports
+    static Level detected();
+    static Level level();
+    // force a level (ie. to compare against Scalar), clamped to detected()
+    static Level setLevel(Level lvl);
+
+    // first byte that is not ' ', '\t', '\r', '\v' or '\f'
+    static const char *skipBlanks(const char *p);
+    // first '\n' or NUL
+    static const char *findLineEnd(const char *p);
+    // first '*', '\n' or NUL
+    static const char *findStar(const char *p);
+    // first quote, '\\', '\n' or NUL
+    static const char *findQuoteEnd(const char *p, char quote);
+};
+
+} // namespace Cmp
+
+#endif // SIMDSCAN_H
@@ -0,0 +1,148 @@
+#include "sourcemanager.h"
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace Cmp;
+using namespace std;
+
+static const size_t tailPadding = 32; // SimdScan widest load
+
+static size_t roundUp(size_t n, size_t to)
+{
+    return (n + to - 1) / to * to;
+}
+
+// -----------------------------------------------------------------------
+
+SourceBuffer::SourceBuffer(const string &name)
+    : _name(name)
+    , _data(nullptr)
+    , _size(0)
+    , _allocLen(0)
+    , _mapped(false)
+{ }
+
+SourceBuffer::~SourceBuffer()
+{
+    if (_mapped)
+        munmap(const_cast<char*>(_data), _allocLen);
+    else
+        free(const_cast<char*>(_data));
+}
+
+// -----------------------------------------------------------------------
+
+SourceManager::SourceManager()
+{ }
+
+SourceManager::~SourceManager()
+{
+    for (auto buf : _buffers)
+        delete buf;
+}
+
+const SourceBuffer *SourceManager::load(const char *filename)
+{
+    bool isStdin = strcmp(filename, "-") == 0;
+    int fd = isStdin ? STDIN_FILENO : open(filename, O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    SourceBuffer *buf = new SourceBuffer(filename);
+    struct stat st;
+    bool res;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+        res = mapFile(buf, fd, static_cast<size_t>(st.st_size));
+    else
+        res = readStream(buf, fd);
+
+    int err = errno;
+    if (!isStdin)
+        close(fd);
+
+    if (!res) {
+        delete buf;
+        errno = err;
+        return nullptr;
+    }
+
+    _buffers.push_back(buf);
+    return buf;
+}
+
+bool SourceManager::mapFile(SourceBuffer *buf, int fd, size_t size)
+{
+    // Reserve the file size plus padding as anonymous zero pages and map
+    // the file over the front of it. The tail of the last file page is
+    // zero filled by the kernel, and when the file ends exactly on a page
+    // boundary the anonymous page behind it is the NUL terminator.
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t allocLen = roundUp(size + tailPadding, page);
+    void *base = mmap(nullptr, allocLen, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        return false;
+
+    if (size > 0) {
+        void *file = mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+        if (file == MAP_FAILED) {
+            int err = errno;
+            munmap(base, allocLen);
+            errno = err;
+            return false;
+        }
+#ifdef MADV_SEQUENTIAL
+        madvise(file, size, MADV_SEQUENTIAL);
+#endif
+    }
+
+    buf->_data = static_cast<const char*>(base);
+    buf->_size = size;
+    buf->_allocLen = allocLen;
+    buf->_mapped = true;
+    return true;
+}
+
+bool SourceManager::readStream(SourceBuffer *buf, int fd)
+{
+    size_t cap = 64 * 1024, size = 0;
+    char *data = static_cast<char*>(malloc(cap + tailPadding));
+    if (!data)
+        return false;
+
+    for (;;) {
+        if (size == cap) {
+            cap *= 2;
+            char *grown = static_cast<char*>(realloc(data, cap + tailPadding));
+            if (!grown) {
+                free(data);
+                return false;
+            }
+            data = grown;
+        }
+        ssize_t n = read(fd, data + size, cap - size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            int err = errno;
+            free(data);
+            errno = err;
+            return false;
+        }
+        if (n == 0)
+            break;
+        size += static_cast<size_t>(n);
+    }
+
+    // malloc only guarantees 16 byte alignment, pad past the next 32 byte block
+    memset(data + size, 0, tailPadding);
+    buf->_data = data;
+    buf->_size = size;
+    buf->_allocLen = cap + tailPadding;
+    buf->_mapped = false;
+    return true;
+}
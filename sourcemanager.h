@@ -0,0 +1,55 @@
+#ifndef SOURCEMANAGER_H
+#define SOURCEMANAGER_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace Cmp {
+
+// one loaded source file, data is always NUL terminated and followed by
+// zero bytes up to at least the next 32 byte boundary (SimdScan reads
+// whole aligned blocks)
+class SourceBuffer
+{
+public:
+    const char *data() const { return _data; }
+    size_t size() const { return _size; }
+    const std::string &name() const { return _name; }
+    bool isMapped() const { return _mapped; }
+
+private:
+    friend class SourceManager;
+    SourceBuffer(const std::string &name);
+    ~SourceBuffer();
+
+    std::string _name;
+    const char *_data;
+    size_t _size,
+           _allocLen;
+    bool _mapped;
+};
+
+// ---------------------------------------------------------------------
+
+// owns the source buffers, regular files are mmapped read only so
+// LexToken::pos points straight into the page cache, pipes and stdin ("-")
+// are read into a heap buffer
+class SourceManager
+{
+    std::vector<SourceBuffer*> _buffers;
+public:
+    explicit SourceManager();
+    ~SourceManager();
+
+    // nullptr on failure, errno tells why
+    const SourceBuffer *load(const char *filename);
+
+private:
+    bool mapFile(SourceBuffer *buf, int fd, size_t size);
+    bool readStream(SourceBuffer *buf, int fd);
+};
+
+} // namespace Cmp
+
+#endif // SOURCEMANAGER_H
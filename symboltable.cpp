@@ -0,0 +1,53 @@
+#include "symboltable.h"
+#include <cassert>
+
+using namespace Cmp;
+using namespace std;
+
+const uint32_t SymbolTable::NoBinding;
+
+SymbolTable::SymbolTable()
+{
+    clear();
+}
+
+void SymbolTable::clear()
+{
+    _bindings.clear();
+    _current.clear();
+    _scopes.assign(1, 0);
+}
+
+void SymbolTable::enterScope()
+{
+    _scopes.push_back(_bindings.size());
+}
+
+void SymbolTable::leaveScope()
+{
+    assert(_scopes.size() > 1 && "can't leave the global scope");
+    for (size_t end = _scopes.back(); _bindings.size() > end; _bindings.pop_back())
+        _current[_bindings.back().sym.name] = _bindings.back().shadow;
+    _scopes.pop_back();
+}
+
+bool SymbolTable::define(const Symbol &sym)
+{
+    if (sym.name >= _current.size())
+        _current.resize(sym.name + 1, NoBinding);
+
+    uint32_t prev = _current[sym.name];
+    if (prev != NoBinding && _bindings[prev].scope == _scopes.size())
+        return false; // already in this scope
+
+    _bindings.push_back(Binding{ sym, static_cast<uint32_t>(_scopes.size()), prev });
+    _current[sym.name] = static_cast<uint32_t>(_bindings.size() - 1);
+    return true;
+}
+
+const Symbol *SymbolTable::lookup(Interner::SymbolId name) const
+{
+    if (name >= _current.size() || _current[name] == NoBinding)
+        return nullptr;
+    return &_bindings[_current[name]].sym;
+}
@@ -0,0 +1,51 @@
+#ifndef SYMBOLTABLE_H
+#define SYMBOLTABLE_H
+
+#include <inttypes.h>
+#include <vector>
+#include "interner.h"
+
+namespace Cmp {
+
+// what a name is bound to in a scope
+struct Symbol {
+    enum Kind { Function, Variable };
+    Interner::SymbolId name;
+    Kind kind;
+    int32_t offset; // frame offset for locals
+};
+
+// scoped names, keyed by interned id. Lookup is an index into the
+// innermost binding for that id, an inner scope shadows outer ones
+// and leaving a scope puts the shadowed bindings back.
+class SymbolTable
+{
+public:
+    explicit SymbolTable();
+
+    void clear();     // back to only the global scope
+    void enterScope();
+    void leaveScope();
+    size_t depth() const { return _scopes.size(); } // 1 is global
+
+    // false if the name is already defined in the current scope
+    bool define(const Symbol &sym);
+    // innermost binding or nullptr
+    const Symbol *lookup(Interner::SymbolId name) const;
+
+private:
+    struct Binding {
+        Symbol sym;
+        uint32_t scope;  // depth it was defined at
+        uint32_t shadow; // previous binding for the same name
+    };
+    static const uint32_t NoBinding = 0xFFFFFFFF;
+
+    std::vector<Binding> _bindings;  // stack, innermost last
+    std::vector<uint32_t> _current;  // SymbolId -> innermost binding
+    std::vector<size_t> _scopes;     // _bindings size when each scope began
+};
+
+} // namespace Cmp
+
+#endif // SYMBOLTABLE_H
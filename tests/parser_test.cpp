@@ -0,0 +1,69 @@
+// streaming the tokens and lexing them all up front must give the same
+// result and the same diagnostics for the same source
+#include "lexer.h"
+#include "parser.h"
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using namespace Cmp;
+using namespace std;
+
+namespace {
+
+int _failures = 0;
+
+bool streamed(const char *src, string &diag)
+{
+    stringstream err;
+    Lexer lex(true);
+    lex.setErrorStream(&err);
+    Parser parser(&lex, "t.c");
+    parser.parseStream(src, "t.c");
+    diag = err.str();
+    return parser.isValid();
+}
+
+bool upFront(const char *src, string &diag)
+{
+    stringstream err;
+    Lexer lex(true);
+    lex.setErrorStream(&err);
+    lex.tokenize(&src, "t.c");
+    Parser parser(&lex, "t.c");
+    diag = err.str();
+    return parser.isValid();
+}
+
+void check(const char *name, const char *src, bool valid)
+{
+    string streamDiag, upFrontDiag;
+    bool s = streamed(src, streamDiag), u = upFront(src, upFrontDiag);
+    if (s != valid || u != valid) {
+        cerr << name << ": expected " << (valid ? "valid" : "an error") << ", streamed "
+             << s << " up front " << u << "\n" << streamDiag;
+        ++_failures;
+    }
+    if (streamDiag != upFrontDiag) {
+        cerr << name << ": diagnostics differ\nstreamed:\n" << streamDiag
+             << "up front:\n" << upFrontDiag;
+        ++_failures;
+    }
+}
+
+} // namespace
+
+int main()
+{
+    check("plain", "int main() { return 2; }\n", true);
+    check("trailing trivia", "int main() { return 2; }\n// done\n/* x */\n\n", true);
+    check("lex error after the function", "int main(){return 2;}\n@\n", false);
+    check("token after the function", "int main(){return 2;} 3\n", false);
+    check("second function", "int main(){return 2;}\nint f(){return 1;}\n", false);
+    check("lex error inside", "int main(){return @2;}\n", false);
+    check("too large litteral", "int main(){return 99999999999;}\n", false);
+
+    if (_failures)
+        cerr << _failures << " failures\n";
+    return _failures ? 1 : 0;
+}
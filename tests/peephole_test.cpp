@@ -0,0 +1,162 @@
+// before/after instruction sequences for the peephole rewrites, each
+// case is one function built straight into an InstList
+#include "peephole.h"
+#include "emitter.h"
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using namespace Cmp;
+using namespace std;
+
+namespace {
+
+int _failures = 0;
+
+Operand reg(Reg r) { return Operand::makeReg(r); }
+Operand imm(int32_t v) { return Operand::makeImm(v); }
+Operand mem(Reg base, int32_t disp) { return Operand::makeMem(base, disp); }
+
+// the code as the .S shows it, without comments and directives
+string code(const InstList &insts)
+{
+    Emitter out;
+    insts.to_asm(out);
+    stringstream text(out.str()), res;
+    string line;
+    while (getline(text, line)) {
+        size_t first = line.find_first_not_of(' ');
+        if (first != string::npos && line[first] != '#')
+            res << line.substr(first) << "\n";
+    }
+    return res.str();
+}
+
+// build fills the function body, expect is what code() gives after the
+// peephole, changes the number of rewrites
+template<typename Build>
+void check(const char *name, Build build, const char *expect, size_t changes)
+{
+    InstList insts;
+    insts.label(insts.newFunction("f", 1));
+    build(insts);
+    string before = code(insts);
+
+    Peephole peep;
+    size_t n = peep.run(insts);
+    string after = code(insts);
+    if (after != expect || n != changes) {
+        cerr << "FAIL " << name << ": " << n << " rewrites, expected " << changes << "\n"
+             << "before:\n" << before << "after:\n" << after << "expected:\n" << expect << "\n";
+        ++_failures;
+    }
+    // the report counts the same code
+    if (peep.stats().size() != 1 || peep.stats()[0].after + n != peep.stats()[0].before) {
+        cerr << "FAIL " << name << ": stats don't add up\n";
+        ++_failures;
+    }
+}
+
+} // namespace
+
+int main()
+{
+    check("move to itself", [](InstList &c) {
+        c.emit(Inst::Mov, reg(Eax), reg(Eax));
+        c.emit(Inst::Ret);
+    }, "f:\nret\n", 1);
+
+    check("overwritten move", [](InstList &c) {
+        c.emit(Inst::Mov, reg(Eax), imm(1));
+        c.emit(Inst::Mov, reg(Eax), imm(2));
+        c.emit(Inst::Ret);
+    }, "f:\nmovl $2, %eax\nret\n", 1);
+
+    check("chain of overwritten moves", [](InstList &c) {
+        c.emit(Inst::Mov, reg(Ecx), imm(1));
+        c.emit(Inst::Mov, reg(Ecx), imm(2));
+        c.emit(Inst::Mov, reg(Ecx), reg(Ecx));
+        c.emit(Inst::Mov, reg(Ecx), imm(3));
+        c.emit(Inst::Mov, reg(Eax), reg(Ecx));
+        c.emit(Inst::Ret);
+    }, "f:\nmovl $3, %ecx\nmovl %ecx, %eax\nret\n", 3);
+
+    check("comments don't end the window", [](InstList &c) {
+        c.emit(Inst::Mov, reg(Eax), imm(5));
+        c.comment("between");
+        c.emit(Inst::Mov, reg(Eax), imm(6));
+        c.emit(Inst::Ret);
+    }, "f:\nmovl $6, %eax\nret\n", 1);
+
+    check("labels end the window", [](InstList &c) {
+        c.emit(Inst::Mov, reg(Eax), imm(5));
+        c.label(c.newLabel(".L", 2, 0));
+        c.emit(Inst::Mov, reg(Eax), imm(6));
+        c.emit(Inst::Ret);
+    }, "f:\nmovl $5, %eax\n.L0:\nmovl $6, %eax\nret\n", 0);
+
+    check("read by the next one", [](InstList &c) {
+        c.emit(Inst::Mov, reg(Eax), imm(1));
+        c.emit(Inst::Add, reg(Ecx), reg(Eax));
+        c.emit(Inst::Mov, reg(Eax), imm(2));
+        c.emit(Inst::Ret);
+    }, "f:\nmovl $1, %eax\naddl %eax, %ecx\nmovl $2, %eax\nret\n", 0);
+
+    check("read as an address", [](InstList &c) {
+        c.emit(Inst::Mov, reg(Ecx), imm(64));
+        c.emit(Inst::Mov, reg(Ecx), mem(Ecx, 4));
+        c.emit(Inst::Ret);
+    }, "f:\nmovl $64, %ecx\nmovl 4(%ecx), %ecx\nret\n", 0);
+
+    check("read by idiv", [](InstList &c) {
+        c.emit(Inst::Mov, reg(Eax), imm(7));
+        c.emit(Inst::Cdq);
+        c.emit(Inst::Idiv, reg(Ecx));
+        c.emit(Inst::Ret);
+    }, "f:\nmovl $7, %eax\ncltd\nidivl %ecx\nret\n", 0);
+
+    check("shift count in %cl", [](InstList &c) {
+        c.emit(Inst::Mov, reg(Ecx), imm(3));
+        c.emit(Inst::Shl, reg(Eax), reg(Ecx));
+        c.emit(Inst::Mov, reg(Ecx), imm(0));
+        c.emit(Inst::Ret);
+    }, "f:\nmovl $3, %ecx\nsall %cl, %eax\nmovl $0, %ecx\nret\n", 0);
+
+    check("setcc only writes the low byte", [](InstList &c) {
+        c.emit(Inst::Mov, reg(Eax), imm(0));
+        c.emit(Inst::Setcc, CondE, reg(Eax));
+        c.emit(Inst::Ret);
+    }, "f:\nmovl $0, %eax\nsete %al\nret\n", 0);
+
+    check("ret reads %eax", [](InstList &c) {
+        c.emit(Inst::Mov, reg(Eax), imm(1));
+        c.emit(Inst::Ret);
+    }, "f:\nmovl $1, %eax\nret\n", 0);
+
+    check("memory is left alone", [](InstList &c) {
+        c.emit(Inst::Mov, mem(Esp, 0), imm(1));
+        c.emit(Inst::Mov, mem(Esp, 0), imm(2));
+        c.emit(Inst::Ret);
+    }, "f:\nmovl $1, (%esp)\nmovl $2, (%esp)\nret\n", 0);
+
+    check("frame moves stay", [](InstList &c) {
+        c.emit(Inst::Push, reg(Ebp));
+        c.emit(Inst::Mov, reg(Ebp), reg(Esp));
+        c.emit(Inst::Mov, reg(Esp), reg(Ebp));
+        c.emit(Inst::Pop, reg(Ebp));
+        c.emit(Inst::Ret);
+    }, "f:\npushl %ebp\nmovl %esp, %ebp\nmovl %ebp, %esp\npopl %ebp\nret\n", 0);
+
+    check("pop overwrites", [](InstList &c) {
+        c.emit(Inst::Mov, reg(Ebx), imm(9));
+        c.emit(Inst::Pop, reg(Ebx));
+        c.emit(Inst::Ret);
+    }, "f:\npopl %ebx\nret\n", 1);
+
+    if (_failures) {
+        cerr << _failures << " failures\n";
+        return 1;
+    }
+    cout << "peephole cases pass\n";
+    return 0;
+}
@@ -0,0 +1,346 @@
+// random expressions through ccomp, with and without register
+// allocation, against what gcc -fwrapv makes of the same C
+//   regalloc_test path/to/ccomp
+// the expressions nest so that more temporaries are live than there are
+// registers, and put divides, shifts and compares (that need %eax, %edx
+// and %ecx) in between. Exit code 77 when there is no gcc.
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <inttypes.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+int _failures = 0;
+string _dir;
+
+// deterministic on every host, rand() is not
+uint32_t _seed = 20240611;
+uint32_t rnd(uint32_t n)
+{
+    _seed = _seed * 1103515245 + 12345;
+    return (_seed >> 8) % n;
+}
+
+int32_t wrap(int64_t v) { return static_cast<int32_t>(static_cast<uint32_t>(v)); }
+
+struct Expr {
+    string src;
+    int32_t value;
+};
+
+const char *const _binOps[] = { "+", "-", "*", "/", "%", "&", "|", "^", "<<", ">>",
+                                "<", "<=", ">", ">=", "==", "!=", "&&", "||" };
+const int _binOpCount = sizeof(_binOps) / sizeof(_binOps[0]);
+
+Expr literal()
+{
+    static const int32_t lits[] = { 0, 1, 2, 3, 7, 15, 100, 255, 65535, 2147483647 };
+    int32_t v = rnd(4) ? lits[rnd(10)] : static_cast<int32_t>(rnd(1000000));
+    Expr e = { to_string(v), v };
+    return e;
+}
+
+// a op b where both are defined, / and % by 0 and INT_MIN / -1 become +
+Expr binary(string op, const Expr &a, const Expr &b)
+{
+    int64_t l = a.value, r = b.value;
+    if ((op == "/" || op == "%") && (r == 0 || (l == INT32_MIN && r == -1)))
+        op = "+";
+    int32_t v = 0;
+    if (op == "+") v = wrap(l + r);
+    else if (op == "-") v = wrap(l - r);
+    else if (op == "*") v = wrap(l * r);
+    else if (op == "/") v = wrap(l / r);
+    else if (op == "%") v = wrap(l % r);
+    else if (op == "&") v = wrap(l & r);
+    else if (op == "|") v = wrap(l | r);
+    else if (op == "^") v = wrap(l ^ r);
+    else if (op == "<") v = l < r;
+    else if (op == "<=") v = l <= r;
+    else if (op == ">") v = l > r;
+    else if (op == ">=") v = l >= r;
+    else if (op == "==") v = l == r;
+    else if (op == "!=") v = l != r;
+    else if (op == "&&") v = l && r;
+    else if (op == "||") v = l || r;
+    Expr e = { "(" + a.src + " " + op + " " + b.src + ")", v };
+    return e;
+}
+
+// the count is a literal, 0..31 is defined for both
+Expr shift(bool left, const Expr &a)
+{
+    int32_t n = static_cast<int32_t>(rnd(32));
+    int32_t v = left ? wrap(static_cast<int64_t>(static_cast<uint32_t>(a.value) << n))
+                     : a.value >> n;
+    Expr e = { "(" + a.src + (left ? " << " : " >> ") + to_string(n) + ")", v };
+    return e;
+}
+
+Expr unary(const Expr &a)
+{
+    Expr e;
+    switch (rnd(3)) {
+    case 0: e.src = "-(" + a.src + ")"; e.value = wrap(-static_cast<int64_t>(a.value)); break;
+    case 1: e.src = "~(" + a.src + ")"; e.value = ~a.value; break;
+    default: e.src = "!(" + a.src + ")"; e.value = !a.value; break;
+    }
+    return e;
+}
+
+Expr tree(int depth)
+{
+    if (depth == 0 || rnd(5) == 0)
+        return literal();
+    if (rnd(6) == 0)
+        return unary(tree(depth - 1));
+    string op = _binOps[rnd(_binOpCount)];
+    if (op == "<<" || op == ">>")
+        return shift(op == "<<", tree(depth - 1));
+    Expr a = tree(depth - 1);
+    return binary(op, a, tree(depth - 1));
+}
+
+// (t op (t op (t op ...))), each left side is computed and stays live
+// while the right side is, length of them at once
+Expr pressure(int length)
+{
+    Expr e = tree(2);
+    for (int i = 0; i < length; ++i) {
+        Expr left = binary("*", literal(), literal());
+        if (rnd(3) == 0)
+            left = tree(3);
+        string op = _binOps[rnd(_binOpCount)];
+        if (op == "<<" || op == ">>")
+            e = shift(op == "<<", e);
+        else
+            e = binary(op, left, e);
+    }
+    return e;
+}
+
+// exit status of cmd, its stdout in out
+int run(const string &cmd, string *out = nullptr)
+{
+    FILE *p = popen(cmd.c_str(), "r");
+    if (!p)
+        return -1;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), p)) > 0) {
+        if (out)
+            out->append(buf, n);
+    }
+    int status = pclose(p);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+void fail(const string &what, const string &file, int64_t got, int64_t expect)
+{
+    cerr << what << " " << file << ": got " << got << " expected " << expect << "\n";
+    ++_failures;
+}
+
+// ccomp --run prints "file: value" for each file in order
+void checkRun(const string &ccomp, const string &flags, const vector<string> &files,
+              const vector<int32_t> &expect)
+{
+    string cmd = ccomp + " --no-fold --run " + flags, out;
+    for (const string &f : files)
+        cmd += " " + f;
+    if (run(cmd + " 2>&1", &out) != 0) {
+        cerr << cmd << " failed:\n" << out;
+        ++_failures;
+        return;
+    }
+    stringstream lines(out);
+    string line;
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (!getline(lines, line) || line.compare(0, files[i].size() + 2, files[i] + ": ") != 0) {
+            cerr << "--run " << flags << ": no result for " << files[i] << "\n";
+            ++_failures;
+            return;
+        }
+        int64_t got = strtoll(line.c_str() + files[i].size() + 2, nullptr, 10);
+        if (got != expect[i])
+            fail("--run " + flags, files[i], got, expect[i]);
+    }
+}
+
+// executables only give back the low 8 bits
+void checkExecutables(const string &ccomp, const string &flags, const vector<string> &files,
+                      const vector<int32_t> &expect)
+{
+    string exe = _dir + "/a.out";
+    for (size_t i = 0; i < files.size(); ++i) {
+        string out;
+        if (run(ccomp + " --no-fold " + flags + " -o " + exe + " " + files[i] + " 2>&1", &out) != 0) {
+            cerr << flags << " " << files[i] << " did not compile:\n" << out;
+            ++_failures;
+            continue;
+        }
+        int got = run(exe);
+        if (got != (expect[i] & 0xFF))
+            fail(flags, files[i], got, expect[i] & 0xFF);
+    }
+}
+
+// what the function saves it must restore in reverse before each ret,
+// and only callee saved registers
+void checkSaves(const string &ccomp, const string &flags, const string &file,
+                const vector<string> &calleeSaved)
+{
+    string out;
+    if (run(ccomp + " --no-fold -S " + flags + " -o " + _dir + "/a.out " + file + " 2>&1", &out) != 0) {
+        cerr << flags << " -S " << file << " did not compile:\n" << out;
+        ++_failures;
+        return;
+    }
+    ifstream asmFile(file + ".S");
+    vector<string> pushes, pops;
+    bool body = false;
+    size_t rets = 0;
+    string line;
+    while (getline(asmFile, line)) {
+        size_t first = line.find_first_not_of(' ');
+        if (first == string::npos || line[first] == '#' || line[first] == '.')
+            continue;
+        string inst = line.substr(first);
+        string op = inst.substr(0, inst.find(' '));
+        string operand = inst.substr(inst.find(' ') + 1);
+        if (op == "main:")
+            continue;
+        if ((op == "pushl" || op == "pushq") && !body) {
+            pushes.push_back(operand);
+        } else if (op == "popl" || op == "popq") {
+            pops.push_back(operand);
+        } else if (op == "ret") {
+            // %ebp is pushed after the saves and popped first
+            vector<string> saved(pushes);
+            if (!saved.empty() && (saved.back() == "%ebp" || saved.back() == "%rbp"))
+                saved.pop_back();
+            vector<string> restored(pops.rbegin(), pops.rend());
+            if (!restored.empty() && (restored.back() == "%ebp" || restored.back() == "%rbp"))
+                restored.pop_back();
+            if (restored != saved) {
+                cerr << flags << " " << file << ": pops before ret " << rets << " don't mirror the pushes\n";
+                ++_failures;
+            }
+            pops.clear();
+            ++rets;
+        } else
+            body = true;
+    }
+    for (const string &r : pushes) {
+        bool ok = r == "%ebp" || r == "%rbp";
+        for (const string &c : calleeSaved)
+            ok = ok || r == c;
+        if (!ok) {
+            cerr << flags << " " << file << ": saves " << r << " that isn't callee saved\n";
+            ++_failures;
+        }
+    }
+    if (!rets) {
+        cerr << flags << " " << file << ": no ret\n";
+        ++_failures;
+    }
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        cerr << "usage: " << argv[0] << " path/to/ccomp\n";
+        return 1;
+    }
+    string ccomp = argv[1];
+    if (run("gcc --version > /dev/null 2>&1") != 0) {
+        cerr << "no gcc, skipped\n";
+        return 77;
+    }
+    char tmpl[] = "/tmp/regalloc_testXXXXXX";
+    if (!mkdtemp(tmpl)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    _dir = tmpl;
+
+    vector<Expr> exprs;
+    for (int i = 0; i < 30; ++i)
+        exprs.push_back(tree(1 + static_cast<int>(rnd(7))));
+    // past the 5 i386 and 13 x86-64 registers
+    for (int i = 0; i < 30; ++i)
+        exprs.push_back(pressure(4 + static_cast<int>(rnd(24))));
+
+    vector<string> files;
+    ofstream ref(_dir + "/ref.c");
+    ref << "#include <stdio.h>\nint main() {\n";
+    for (size_t i = 0; i < exprs.size(); ++i) {
+        files.push_back(_dir + "/t" + to_string(i) + ".c");
+        ofstream(files.back()) << "int main() {\n    return " << exprs[i].src << ";\n}\n";
+        ref << "    printf(\"%d\\n\", " << exprs[i].src << ");\n";
+    }
+    ref << "    return 0;\n}\n";
+    ref.close();
+
+    // gcc has the last word, the values above only keep out undefined behaviour
+    string out;
+    if (run("gcc -fwrapv -w -o " + _dir + "/ref " + _dir + "/ref.c 2>&1", &out) != 0 ||
+        run(_dir + "/ref", &out) != 0)
+    {
+        cerr << "reference program failed:\n" << out;
+        return 1;
+    }
+    vector<int32_t> expect;
+    stringstream values(out);
+    int64_t v;
+    while (values >> v)
+        expect.push_back(static_cast<int32_t>(v));
+    if (expect.size() != exprs.size()) {
+        cerr << "reference gave " << expect.size() << " values for " << exprs.size() << " expressions\n";
+        return 1;
+    }
+    for (size_t i = 0; i < exprs.size(); ++i) {
+        if (expect[i] != exprs[i].value)
+            cerr << "note: gcc says " << expect[i] << ", the generator " << exprs[i].value
+                 << " for " << files[i] << "\n";
+    }
+
+    const char *const targets[] = { "-m32", "-m64" };
+    for (const char *t : targets) {
+        string target = t;
+        checkRun(ccomp, target, files, expect);
+        checkRun(ccomp, target + " --no-regalloc", files, expect);
+        checkRun(ccomp, target + " -g", files, expect);
+        checkExecutables(ccomp, target, files, expect);
+    }
+    checkExecutables(ccomp, "-G -m64", files, expect);
+    // most hosts have no 32bit libc to link with
+    if (run("echo 'int main(){return 0;}' | gcc -m32 -x c -o " + _dir + "/m32 - > /dev/null 2>&1") == 0)
+        checkExecutables(ccomp, "-G -m32", files, expect);
+    else
+        cerr << "no gcc -m32, -G -m32 left out\n";
+
+    vector<string> saved32 = { "%ebx", "%esi", "%edi" };
+    vector<string> saved64 = { "%rbx", "%r12", "%r13", "%r14", "%r15" };
+    for (size_t i = 30; i < files.size(); ++i) {
+        checkSaves(ccomp, "-m32", files[i], saved32);
+        checkSaves(ccomp, "-m64", files[i], saved64);
+        checkSaves(ccomp, "-m64 -g", files[i], saved64);
+    }
+
+    run("rm -rf " + _dir);
+    if (_failures)
+        cerr << _failures << " failures\n";
+    return _failures ? 1 : 0;
+}
@@ -0,0 +1,123 @@
+// runs every SimdScan kernel at each level the cpu has over the same
+// buffers and checks they stop at the same byte as the scalar loop
+#include "simdscan.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+
+using namespace Cmp;
+using namespace std;
+
+namespace {
+
+// the kernels read whole aligned 32 byte blocks, like SourceBuffer the
+// buffer is zero padded past the terminator
+const size_t BufSize = 512;
+alignas(64) char _buf[BufSize];
+
+int _failures = 0;
+const char *const _levelNames[] = { "scalar", "sse2", "avx2" };
+
+typedef const char *(*Kernel)(const char *p, char quote);
+
+struct Case {
+    const char *name;
+    Kernel kernel;
+    const char *fill;    // bytes the kernel runs over
+    const char *targets; // bytes it stops at
+    char quote;
+};
+
+const char *skipBlanks(const char *p, char) { return SimdScan::skipBlanks(p); }
+const char *findLineEnd(const char *p, char) { return SimdScan::findLineEnd(p); }
+const char *findStar(const char *p, char) { return SimdScan::findStar(p); }
+const char *findQuoteEnd(const char *p, char quote) { return SimdScan::findQuoteEnd(p, quote); }
+
+const Case _cases[] = {
+    { "skipBlanks", skipBlanks, " \t\r\v\f", "x\n\x80#", 0 },
+    { "findLineEnd", findLineEnd, "ab* \t\"\\\x80\xff", "\n", 0 },
+    { "findStar", findStar, "ab/ \t\"\\\x80\xff", "*\n", 0 },
+    { "findQuoteEnd", findQuoteEnd, "ab' \t*/\x80\xff", "\"\\\n", '"' },
+    { "findQuoteEnd'", findQuoteEnd, "ab\" \t*/\x80\xff", "'\\\n", '\'' },
+};
+
+// scalar result first, the others must agree with it
+void compare(const Case &c, const char *start, const char *what, size_t len)
+{
+    SimdScan::Level top = SimdScan::detected();
+    SimdScan::setLevel(SimdScan::Scalar);
+    const char *expect = c.kernel(start, c.quote);
+    for (int lvl = SimdScan::Sse2; lvl <= top; ++lvl) {
+        SimdScan::setLevel(static_cast<SimdScan::Level>(lvl));
+        const char *got = c.kernel(start, c.quote);
+        if (got != expect) {
+            cerr << c.name << " " << _levelNames[lvl] << ": " << what << ", align "
+                 << (reinterpret_cast<uintptr_t>(start) & 63) << " length " << len
+                 << ": stopped at " << (got - start) << ", scalar at " << (expect - start) << "\n";
+            ++_failures;
+        }
+    }
+    SimdScan::setLevel(top);
+}
+
+// bytes in front of start are targets, the kernels must not see them
+void fill(const Case &c, size_t offset, size_t len, unsigned seed)
+{
+    memset(_buf, 0, BufSize);
+    for (size_t i = 0; i < offset; ++i)
+        _buf[i] = c.targets[i % strlen(c.targets)];
+    size_t n = strlen(c.fill);
+    for (size_t i = 0; i < len; ++i)
+        _buf[offset + i] = c.fill[(i * 7 + seed) % n];
+}
+
+} // namespace
+
+int main()
+{
+    cout << "simdscan levels up to " << _levelNames[SimdScan::detected()] << "\n";
+    srand(1);
+
+    for (const Case &c : _cases) {
+        // every alignment of the start and of the terminator
+        for (size_t offset = 0; offset < 64; ++offset) {
+            for (size_t len = 0; len <= 96; ++len) {
+                const char *start = _buf + offset;
+                fill(c, offset, len, static_cast<unsigned>(len));
+                compare(c, start, "no match", len);
+
+                for (const char *t = c.targets; *t; ++t) {
+                    if (len == 0)
+                        break;
+                    fill(c, offset, len, static_cast<unsigned>(len));
+                    _buf[offset + len - 1] = *t;
+                    compare(c, start, "match in the last byte", len);
+
+                    fill(c, offset, len, static_cast<unsigned>(len));
+                    _buf[offset + static_cast<size_t>(rand()) % len] = *t;
+                    compare(c, start, "match inside", len);
+                }
+            }
+        }
+
+        // random bytes, high ones too
+        for (int round = 0; round < 2000; ++round) {
+            size_t offset = static_cast<size_t>(rand()) % 64, len = static_cast<size_t>(rand()) % 300;
+            memset(_buf, 0, BufSize);
+            for (size_t i = 0; i < offset + len; ++i) {
+                char b = static_cast<char>(rand() % 255 + 1);
+                _buf[i] = rand() % 4 ? c.fill[static_cast<size_t>(rand()) % strlen(c.fill)] : b;
+            }
+            compare(c, _buf + offset, "random", len);
+        }
+    }
+
+    if (_failures) {
+        cerr << _failures << " mismatches\n";
+        return 1;
+    }
+    cout << "all kernels agree\n";
+    return 0;
+}
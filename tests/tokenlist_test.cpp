@@ -0,0 +1,56 @@
+// tokens read back from a TokenList are the ones put in, values and
+// long lengths across the 64 token blocks of the value index
+#include "lexer.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace Cmp;
+using namespace std;
+
+namespace {
+
+int _failures = 0;
+
+void check(bool ok, const string &what, size_t i)
+{
+    if (!ok) {
+        cerr << what << " wrong for token " << i << "\n";
+        ++_failures;
+    }
+}
+
+} // namespace
+
+int main()
+{
+    string src(200000, 'x');
+    TokenList list(src.c_str());
+    vector<LexToken> expect;
+    // every pattern of value and no value tokens, whole blocks of each
+    // and a 70000 char token now and then
+    for (size_t i = 0; i < 1000; ++i) {
+        LexToken::Tokens type = LexToken::SemiColon;
+        if ((i < 64) || (i >= 128 && i < 192) || (i >= 200 && (i * 7) % 3 == 0))
+            type = i % 2 ? LexToken::Identifier : LexToken::HexLitteral;
+        size_t len = i % 97 == 0 ? 70000 : i % 13;
+        uint64_t value = LexToken::hasValue(type) ? 0xFFFFFFFF00000000ull + i * 1234567 : 0;
+        LexToken tok(type, src.c_str() + i * 100, len, value);
+        list.push_back(tok);
+        expect.push_back(tok);
+    }
+    list.shrink_to_fit();
+
+    check(list.size() == expect.size(), "size", list.size());
+    for (size_t i = 0; i < expect.size() && i < list.size(); ++i) {
+        LexToken tok = list[i];
+        check(tok.type == expect[i].type, "type", i);
+        check(tok.pos == expect[i].pos, "pos", i);
+        check(tok.len == expect[i].len, "len", i);
+        check(tok.value == expect[i].value, "value", i);
+    }
+
+    if (_failures)
+        cerr << _failures << " failures\n";
+    return _failures ? 1 : 0;
+}
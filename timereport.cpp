@@ -0,0 +1,169 @@
+#include "timereport.h"
+#include <time.h>
+#include <sys/resource.h>
+#include <iomanip>
+
+using namespace Cmp;
+using namespace std;
+
+namespace {
+
+double seconds(clockid_t clock)
+{
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 1e-9;
+}
+
+// user + sys of children that have been waited for
+double childCpu()
+{
+    rusage ru;
+    getrusage(RUSAGE_CHILDREN, &ru);
+    return static_cast<double>(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) +
+           static_cast<double>(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e-6;
+}
+
+double cpuNow(TimeReport::Phase phase)
+{
+    double cpu = seconds(CLOCK_THREAD_CPUTIME_ID);
+    return phase == TimeReport::Gcc ? cpu + childCpu() : cpu;
+}
+
+void jsonString(ostream &out, const char *str)
+{
+    out << '"';
+    for (const char *c = str; *c; ++c) {
+        if (*c == '"' || *c == '\\')
+            out << '\\' << *c;
+        else if (static_cast<unsigned char>(*c) < 0x20)
+            out << "\\u" << hex << setw(4) << setfill('0') << static_cast<int>(*c)
+                << dec << setfill(' ');
+        else
+            out << *c;
+    }
+    out << '"';
+}
+
+} // namespace
+
+TimeReport::TimeReport()
+    : _cur(Read)
+    , _running(false)
+    , _wallStart(0)
+    , _cpuStart(0)
+{ }
+
+void TimeReport::start(Phase phase)
+{
+    stop();
+    _cur = phase;
+    _running = true;
+    _wallStart = seconds(CLOCK_MONOTONIC);
+    _cpuStart = cpuNow(phase);
+}
+
+void TimeReport::stop()
+{
+    if (!_running)
+        return;
+    Times &t = _times[_cur];
+    t.ran = true;
+    t.wall += seconds(CLOCK_MONOTONIC) - _wallStart;
+    t.cpu += cpuNow(_cur) - _cpuStart;
+    _running = false;
+}
+
+const char *TimeReport::phase_to_cstr(Phase phase)
+{
+    switch (phase) {
+    case Read: return "file read";
+    case Lex: return "lex";
+    case Parse: return "parse";
+    case Fold: return "constant fold";
+    case Lower: return "ir lowering";
+    case Generate: return "generate";
+    case Peephole: return "peephole";
+    case WriteAsm: return ".S write";
+    case Encode: return "encode + ELF write";
+    case Gcc: return "gcc";
+    case Run: return "run";
+    case PhaseCount: break;
+    }
+    return "?";
+}
+
+double TimeReport::totalWall() const
+{
+    double sum = 0;
+    for (const Times &t : _times)
+        sum += t.wall;
+    return sum;
+}
+
+double TimeReport::totalCpu() const
+{
+    double sum = 0;
+    for (const Times &t : _times)
+        sum += t.cpu;
+    return sum;
+}
+
+double TimeReport::tokensPerSecond() const
+{
+    double wall = _times[Lex].wall;
+    return wall > 0 ? static_cast<double>(_counters.tokens) / wall : 0;
+}
+
+void TimeReport::print(ostream &out, const char *filename) const
+{
+    double wall = totalWall(), cpu = totalCpu();
+    out << "Time report for " << filename << "\n"
+        << left << setw(22) << " phase" << right << setw(12) << "wall ms"
+        << setw(8) << "%" << setw(12) << "cpu ms" << "\n" << fixed;
+    for (int p = 0; p < PhaseCount; ++p) {
+        const Times &t = _times[p];
+        if (!t.ran)
+            continue;
+        out << ' ' << left << setw(21) << phase_to_cstr(static_cast<Phase>(p)) << right
+            << setw(12) << setprecision(3) << t.wall * 1e3
+            << setw(8) << setprecision(1) << (wall > 0 ? 100 * t.wall / wall : 0)
+            << setw(12) << setprecision(3) << t.cpu * 1e3 << "\n";
+    }
+    out << ' ' << left << setw(21) << "total" << right
+        << setw(12) << setprecision(3) << wall * 1e3 << setw(8) << ""
+        << setw(12) << cpu * 1e3 << "\n";
+
+    out << setprecision(0)
+        << " bytes read        " << _counters.bytesRead << "\n"
+        << " tokens            " << _counters.tokens << " (" << tokensPerSecond() << " per second)\n"
+        << " ast nodes         " << _counters.astNodes << "\n"
+        << " instructions      " << _counters.instructions << "\n"
+        << " output bytes      " << _counters.outputBytes << "\n";
+    out.unsetf(ios::floatfield);
+    out << setprecision(6);
+}
+
+void TimeReport::json(ostream &out, const char *filename) const
+{
+    out << "{\"file\": ";
+    jsonString(out, filename);
+    out << ", \"phases\": {";
+    bool first = true;
+    for (int p = 0; p < PhaseCount; ++p) {
+        const Times &t = _times[p];
+        if (!t.ran)
+            continue;
+        out << (first ? "" : ", ");
+        jsonString(out, phase_to_cstr(static_cast<Phase>(p)));
+        out << ": {\"wall\": " << t.wall << ", \"cpu\": " << t.cpu << "}";
+        first = false;
+    }
+    out << "}, \"total\": {\"wall\": " << totalWall() << ", \"cpu\": " << totalCpu() << "}"
+        << ", \"bytes_read\": " << _counters.bytesRead
+        << ", \"tokens\": " << _counters.tokens
+        << ", \"tokens_per_second\": " << tokensPerSecond()
+        << ", \"ast_nodes\": " << _counters.astNodes
+        << ", \"instructions\": " << _counters.instructions
+        << ", \"output_bytes\": " << _counters.outputBytes << "}";
+}
@@ -0,0 +1,65 @@
+#ifndef TIMEREPORT_H
+#define TIMEREPORT_H
+
+#include <inttypes.h>
+#include <cstddef>
+#include <ostream>
+
+namespace Cmp {
+
+// wall and cpu time of each phase of compiling one file, and counters
+// for what went through them. CPU time is the calling thread's, the gcc
+// phase adds what finished child processes used (exact with -j1)
+class TimeReport
+{
+public:
+    enum Phase {
+        Read, Lex, Parse, Fold, Lower, Generate, Peephole, WriteAsm,
+        Encode, Gcc, Run,
+        PhaseCount
+    };
+
+    struct Counters {
+        size_t bytesRead = 0;
+        size_t tokens = 0;
+        size_t astNodes = 0;
+        size_t instructions = 0; // after peephole
+        size_t outputBytes = 0;  // .S, executable or jit code
+    };
+
+    explicit TimeReport();
+
+    // a phase runs until the next start or stop, phases not run are left
+    // out of the report
+    void start(Phase phase);
+    void stop();
+
+    Counters &counters() { return _counters; }
+    const Counters &counters() const { return _counters; }
+
+    // like gcc -ftime-report, a line per phase and the counters
+    void print(std::ostream &out, const char *filename) const;
+    // one JSON object, the caller puts them in an array
+    void json(std::ostream &out, const char *filename) const;
+
+    static const char *phase_to_cstr(Phase phase);
+
+private:
+    struct Times {
+        bool ran = false;
+        double wall = 0, cpu = 0; // seconds
+    };
+    double totalWall() const;
+    double totalCpu() const;
+    double tokensPerSecond() const;
+
+    Times _times[PhaseCount];
+    Counters _counters;
+    Phase _cur;
+    bool _running;
+    double _wallStart, _cpuStart;
+};
+
+} // namespace Cmp
+
+#endif // TIMEREPORT_H
@@ -0,0 +1,290 @@
+#include "x86encoder.h"
+
+using namespace Cmp;
+using namespace std;
+
+static inline bool isInt8(int32_t v) { return v >= -128 && v <= 127; }
+
+// r8-r15, only there in 64bit mode
+static inline bool isExtended(const Operand &o)
+{
+    return (o.kind == Operand::Register || o.kind == Operand::Mem) && o.reg >= R8;
+}
+
+X86Encoder::X86Encoder(ostream &err, Mode mode)
+    : _err(err)
+    , _mode(mode)
+    , _code(nullptr)
+{ }
+
+bool X86Encoder::encodeExecutable(const InstList &insts, vector<uint8_t> &code, size_t &entry)
+{
+    InstList::LabelId mainLbl = insts.findLabel("main");
+    if (mainLbl == InstList::NoLabel) {
+        _err << "No main function to start from\n";
+        return false;
+    }
+    code.clear();
+    _code = &code;
+    _labelPos.assign(insts.labelCount(), -1);
+    _fixups.clear();
+
+    entry = 0;
+    byte(0xE8); rel32(mainLbl);
+    if (_mode == Mode32) {
+        // _start: call main; movl %eax, %ebx; movl $1, %eax; int $0x80
+        byte(0x89); byte(0xC3);
+        byte(0xB8); imm32(1);
+        byte(0xCD); byte(0x80);
+    } else {
+        // _start: call main; movl %eax, %edi; movl $60, %eax; syscall
+        byte(0x89); byte(0xC7);
+        byte(0xB8); imm32(60);
+        byte(0x0F); byte(0x05);
+    }
+
+    return encode(insts, code);
+}
+
+bool X86Encoder::encode(const InstList &insts, vector<uint8_t> &code)
+{
+    if (_code != &code) {
+        code.clear();
+        _code = &code;
+        _labelPos.assign(insts.labelCount(), -1);
+        _fixups.clear();
+    }
+
+    bool res = true;
+    for (const Inst &inst : insts)
+        res = encodeInst(inst) && res;
+
+    for (const Fixup &f : _fixups) {
+        if (_labelPos[f.label] < 0) {
+            const InstList::LabelInfo &l = insts.labelInfo(f.label);
+            _err << "Undefined label " << string(l.name, l.len) << "\n";
+            res = false;
+            continue;
+        }
+        int32_t rel = static_cast<int32_t>(_labelPos[f.label] - static_cast<int64_t>(f.pos + 4));
+        for (int i = 0; i < 4; ++i)
+            code[f.pos + i] = static_cast<uint8_t>(static_cast<uint32_t>(rel) >> (i * 8));
+    }
+
+    _code = nullptr;
+    return res;
+}
+
+void X86Encoder::imm32(int32_t v)
+{
+    uint32_t u = static_cast<uint32_t>(v);
+    for (int i = 0; i < 4; ++i)
+        byte(static_cast<uint8_t>(u >> (i * 8)));
+}
+
+void X86Encoder::rel32(InstList::LabelId label)
+{
+    _fixups.push_back(Fixup{ _code->size(), label });
+    imm32(0);
+}
+
+void X86Encoder::modrm(uint8_t regField, const Operand &rm)
+{
+    // the top bit of r8-r15 went into the REX prefix
+    regField &= 7;
+    uint8_t base = rm.reg & 7;
+    if (rm.kind == Operand::Register) {
+        byte(static_cast<uint8_t>(0xC0 | (regField << 3) | base));
+        return;
+    }
+
+    // [base + disp], esp/r12 as base needs a SIB byte, ebp/r13 always a disp
+    uint8_t mod = rm.value == 0 && base != Ebp ? 0x00 :
+                  isInt8(rm.value) ? 0x40 : 0x80;
+    byte(static_cast<uint8_t>(mod | (regField << 3) | base));
+    if (base == Esp)
+        byte(0x24);
+    if (mod == 0x40)
+        byte(static_cast<uint8_t>(rm.value));
+    else if (mod == 0x80)
+        imm32(rm.value);
+}
+
+// add/or/and/sub/xor/cmp: opRm is the "r/m, reg" opcode, opReg the
+// "reg, r/m" one, digit the /n for the immediate forms
+void X86Encoder::alu(uint8_t opRm, uint8_t opReg, uint8_t digit, const Inst &inst)
+{
+    if (inst.src.kind == Operand::Imm) {
+        rex(wide(inst), 0, inst.dst);
+        byte(isInt8(inst.src.value) ? 0x83 : 0x81);
+        modrm(digit, inst.dst);
+        if (isInt8(inst.src.value))
+            byte(static_cast<uint8_t>(inst.src.value));
+        else
+            imm32(inst.src.value);
+    } else if (inst.src.kind == Operand::Mem) {
+        rex(wide(inst), inst.dst.reg, inst.src);
+        byte(opReg);
+        modrm(inst.dst.reg, inst.src);
+    } else {
+        rex(wide(inst), inst.src.reg, inst.dst);
+        byte(opRm);
+        modrm(inst.src.reg, inst.dst);
+    }
+}
+
+// in 64bit mode the stack and frame pointers are 64bit, moves and
+// arithmetic on them must be too or the upper half is lost
+bool X86Encoder::wide(const Inst &inst) const
+{
+    return _mode == Mode64 && (inst.dst.isReg(Esp) || inst.dst.isReg(Ebp) ||
+                               inst.src.isReg(Esp) || inst.src.isReg(Ebp));
+}
+
+// REX prefix when the instruction is 64bit or names r8-r15, regField
+// is the register in the modrm reg field or 0 for a /digit
+void X86Encoder::rex(bool w, uint8_t regField, const Operand &rm)
+{
+    uint8_t prefix = 0x40;
+    if (w)
+        prefix |= 0x08;
+    if (regField & 8)
+        prefix |= 0x04;
+    if ((rm.kind == Operand::Register || rm.kind == Operand::Mem) && (rm.reg & 8))
+        prefix |= 0x01;
+    if (prefix != 0x40)
+        byte(prefix);
+}
+
+bool X86Encoder::unsupported(const Inst &inst)
+{
+    _err << "Can't encode instruction " << static_cast<int>(inst.op) << ", its a bug\n";
+    return false;
+}
+
+bool X86Encoder::encodeInst(const Inst &inst)
+{
+    if (inst.dst.kind == Operand::Virtual || inst.src.kind == Operand::Virtual)
+        return unsupported(inst); // register allocation didn't run
+    if (_mode == Mode32 && (isExtended(inst.dst) || isExtended(inst.src)))
+        return unsupported(inst); // x86-64 code
+
+    switch (inst.op) {
+    case Inst::Comment: case Inst::Directive:
+        break;
+    case Inst::Label:
+        _labelPos[static_cast<size_t>(inst.dst.value)] = static_cast<int64_t>(_code->size());
+        break;
+    case Inst::Push:
+        // always the stack width, no REX.W
+        rex(false, 0, inst.dst);
+        if (inst.dst.kind == Operand::Register)
+            byte(static_cast<uint8_t>(0x50 + (inst.dst.reg & 7)));
+        else if (inst.dst.kind == Operand::Imm && isInt8(inst.dst.value)) {
+            byte(0x6A);
+            byte(static_cast<uint8_t>(inst.dst.value));
+        } else if (inst.dst.kind == Operand::Imm) {
+            byte(0x68);
+            imm32(inst.dst.value);
+        } else {
+            byte(0xFF);
+            modrm(6, inst.dst);
+        }
+        break;
+    case Inst::Pop:
+        rex(false, 0, inst.dst);
+        if (inst.dst.kind != Operand::Register) {
+            byte(0x8F);
+            modrm(0, inst.dst);
+        } else
+            byte(static_cast<uint8_t>(0x58 + (inst.dst.reg & 7)));
+        break;
+    case Inst::Mov:
+        if (inst.src.kind == Operand::Imm && inst.dst.kind == Operand::Register) {
+            rex(wide(inst), 0, inst.dst);
+            byte(static_cast<uint8_t>(0xB8 + (inst.dst.reg & 7)));
+            imm32(inst.src.value);
+        } else if (inst.src.kind == Operand::Imm) {
+            rex(wide(inst), 0, inst.dst);
+            byte(0xC7);
+            modrm(0, inst.dst);
+            imm32(inst.src.value);
+        } else if (inst.src.kind == Operand::Mem) {
+            rex(wide(inst), inst.dst.reg, inst.src);
+            byte(0x8B);
+            modrm(inst.dst.reg, inst.src);
+        } else {
+            rex(wide(inst), inst.src.reg, inst.dst);
+            byte(0x89);
+            modrm(inst.src.reg, inst.dst);
+        }
+        break;
+    case Inst::Add: alu(0x01, 0x03, 0, inst); break;
+    case Inst::Or:  alu(0x09, 0x0B, 1, inst); break;
+    case Inst::And: alu(0x21, 0x23, 4, inst); break;
+    case Inst::Sub: alu(0x29, 0x2B, 5, inst); break;
+    case Inst::Xor: alu(0x31, 0x33, 6, inst); break;
+    case Inst::Cmp: alu(0x39, 0x3B, 7, inst); break;
+    case Inst::Imul:
+        if (inst.dst.kind != Operand::Register)
+            return unsupported(inst);
+        if (inst.src.kind == Operand::Imm) {
+            rex(false, inst.dst.reg, inst.dst);
+            byte(isInt8(inst.src.value) ? 0x6B : 0x69);
+            modrm(inst.dst.reg, inst.dst);
+            if (isInt8(inst.src.value))
+                byte(static_cast<uint8_t>(inst.src.value));
+            else
+                imm32(inst.src.value);
+        } else {
+            rex(false, inst.dst.reg, inst.src);
+            byte(0x0F); byte(0xAF);
+            modrm(inst.dst.reg, inst.src);
+        }
+        break;
+    case Inst::Neg:  rex(false, 0, inst.dst); byte(0xF7); modrm(3, inst.dst); break;
+    case Inst::Not:  rex(false, 0, inst.dst); byte(0xF7); modrm(2, inst.dst); break;
+    case Inst::Idiv: rex(false, 0, inst.dst); byte(0xF7); modrm(7, inst.dst); break;
+    case Inst::Cdq:  byte(0x99); break;
+    case Inst::Shl: case Inst::Sar: {
+        uint8_t digit = inst.op == Inst::Shl ? 4 : 7;
+        rex(false, 0, inst.dst);
+        if (inst.src.kind == Operand::Imm) {
+            byte(0xC1);
+            modrm(digit, inst.dst);
+            byte(static_cast<uint8_t>(inst.src.value));
+        } else if (inst.src.isReg(Ecx)) {
+            byte(0xD3);
+            modrm(digit, inst.dst);
+        } else
+            return unsupported(inst);
+    } break;
+    case Inst::Setcc:
+        if (inst.dst.kind != Operand::Register || inst.dst.reg > Ebx)
+            return unsupported(inst);
+        byte(0x0F); byte(static_cast<uint8_t>(0x90 + inst.cond));
+        modrm(0, inst.dst);
+        break;
+    case Inst::Movzb:
+        if (inst.src.kind == Operand::Register && inst.src.reg > Ebx)
+            return unsupported(inst);
+        rex(false, inst.dst.reg, inst.src);
+        byte(0x0F); byte(0xB6);
+        modrm(inst.dst.reg, inst.src);
+        break;
+    case Inst::Jmp:
+        byte(0xE9); rel32(static_cast<InstList::LabelId>(inst.dst.value));
+        break;
+    case Inst::Jcc:
+        byte(0x0F); byte(static_cast<uint8_t>(0x80 + inst.cond));
+        rel32(static_cast<InstList::LabelId>(inst.dst.value));
+        break;
+    case Inst::Call:
+        byte(0xE8); rel32(static_cast<InstList::LabelId>(inst.dst.value));
+        break;
+    case Inst::Ret:
+        byte(0xC3);
+        break;
+    }
+    return true;
+}
@@ -0,0 +1,57 @@
+#ifndef X86ENCODER_H
+#define X86ENCODER_H
+
+#include <inttypes.h>
+#include <vector>
+#include <ostream>
+#include "instlist.h"
+
+namespace Cmp {
+
+// turns an InstList into i386 machine code, jumps and calls are always
+// rel32 and resolved when all labels are known.
+// Mode64 encodes for x86-64, the i386 code for --run or the -m64 code.
+// %esp/%ebp hold pointers there and get a REX.W prefix, %r8-%r15 a
+// REX.R or REX.B
+class X86Encoder
+{
+public:
+    enum Mode { Mode32, Mode64 };
+
+    explicit X86Encoder(std::ostream &err, Mode mode = Mode32);
+
+    // a _start that calls main and exits with its return value
+    // goes first, entry is where it begins in code. int $0x80 exit
+    // in Mode32, syscall exit in Mode64
+    bool encodeExecutable(const InstList &insts, std::vector<uint8_t> &code, size_t &entry);
+    // just the instructions
+    bool encode(const InstList &insts, std::vector<uint8_t> &code);
+    // where a label ended up in the last encoded code, -1 if not placed
+    int64_t labelPos(InstList::LabelId id) const { return _labelPos[id]; }
+
+private:
+    struct Fixup {
+        size_t pos; // of the rel32
+        InstList::LabelId label;
+    };
+
+    bool encodeInst(const Inst &inst);
+    void modrm(uint8_t regField, const Operand &rm);
+    void alu(uint8_t opRm, uint8_t opReg, uint8_t digit, const Inst &inst);
+    void rel32(InstList::LabelId label);
+    void byte(uint8_t b) { _code->push_back(b); }
+    void imm32(int32_t v);
+    bool unsupported(const Inst &inst);
+    bool wide(const Inst &inst) const;
+    void rex(bool w, uint8_t regField, const Operand &rm);
+
+    std::ostream &_err;
+    Mode _mode;
+    std::vector<uint8_t> *_code;
+    std::vector<int64_t> _labelPos;
+    std::vector<Fixup> _fixups;
+};
+
+} // namespace Cmp
+
+#endif // X86ENCODER_H